@@ -1,13 +1,22 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <time.h>
+#include <math.h>
+#include <string.h>
+#include "bench_harness.h"
+#include "perf_counters.h"
+#include "topology.h"
 
 #define N 1024
 
 long long numbers[N];
 
+PerfPhase phase_sum = PERF_PHASE_INIT("sum partition");
+
 typedef struct{
+    const long long *array; //array being summed
     long long start_index; //start index of current thread
     long long end_index; //end index of current thread
     long long partialSum; //partial sum calculated by current thread
@@ -16,41 +25,45 @@ typedef struct{
 void* sum_helper(void* arg){
     ThreadData* data = (ThreadData*)arg; //typecasting arg to thread_data
     long long sum = 0;
+    PerfThreadCounters pc;
+    perf_phase_begin(&pc);
 
     for(long long i = data->start_index; i<= data->end_index; i++){
-        sum += numbers[i];
+        sum += data->array[i];
     }
     data->partialSum = sum;
+    perf_phase_end(&pc, &phase_sum);
     pthread_exit(NULL);
 }
 
-int main(int argc, char **argv){
-    int num_threads = atoi(argv[1]);
-
-    for(int i = 0; i< N;i++){
-        numbers[i] = i + 1;
-    }
-    struct timespec start_time, end_time;
-    clock_gettime(CLOCK_MONOTONIC, &start_time);
-
+//sums array[0..n-1] with num_threads threads into *total, returns 0 on success and -1 if a thread could not be
+//created or joined
+int parallel_sum(const long long *array, long long n, int num_threads, long long *total){
     pthread_t threads[num_threads]; //holds the unique identifiers the OS gives to each of the threads u create
     ThreadData thread_data[num_threads]; //holds the arguments to pass into each of the thread
 
-    int partition_size = N / num_threads;
-    int start_idx = 0;
+    long long partition_size = n / num_threads;
+    long long start_idx = 0;
 
     //threads are summing the values individually.....
     for(int i = 0; i < num_threads; i++){
+        thread_data[i].array = array;
         thread_data[i].start_index = start_idx;
         if(i == num_threads - 1){
-            thread_data[i].end_index = N - 1;
+            thread_data[i].end_index = n - 1;
         }else{
             thread_data[i].end_index = start_idx + partition_size - 1;
         }
         thread_data[i].partialSum = 0;
-        if(pthread_create(&threads[i],NULL,sum_helper,&thread_data[i])  != 0){
-            perror("Failed to create thread");
-            return 1;
+        pthread_attr_t attr;
+        int created = pthread_create(&threads[i],topo_attr_for_thread(&attr, i),sum_helper,&thread_data[i]);
+        pthread_attr_destroy(&attr);
+        if(created != 0){
+            fprintf(stderr, "Failed to create thread: %s\n", strerror(created)); //pthread_create does not set errno
+            for(int j = 0; j < i; j++){ //the running threads still use thread_data
+                pthread_join(threads[j], NULL);
+            }
+            return -1;
         }
         start_idx += partition_size;
     }
@@ -60,18 +73,93 @@ int main(int argc, char **argv){
     for(int i = 0; i< num_threads;i++){
         if(pthread_join(threads[i],NULL) != 0){
             perror("Failed to join threads");
-            return 1;
+            return -1;
         }
         totalSum += thread_data[i].partialSum;
     }
+    *total = totalSum;
+    return 0;
+}
+
+typedef struct{
+    long long *array;
+    long long n;
+    int num_threads;
+}SumBench;
+
+void* sum_bench_setup(long long size, int num_threads){
+    SumBench *ctx = (SumBench*)malloc(sizeof(SumBench));
+    if(ctx == NULL){
+        return NULL;
+    }
+    ctx->array = (long long*)malloc(size * sizeof(long long));
+    if(ctx->array == NULL){
+        free(ctx);
+        return NULL;
+    }
+    for(long long i = 0; i < size; i++){
+        ctx->array[i] = i + 1;
+    }
+    ctx->n = size;
+    ctx->num_threads = num_threads;
+    return ctx;
+}
+
+double sum_bench_run(void *arg){
+    SumBench *ctx = (SumBench*)arg;
+    long long total;
+    if(parallel_sum(ctx->array, ctx->n, ctx->num_threads, &total) != 0){
+        return NAN; //never equal to the checksum of a good run, so the harness flags it
+    }
+    return (double)total;
+}
+
+void sum_bench_teardown(void *arg){
+    SumBench *ctx = (SumBench*)arg;
+    free(ctx->array);
+    free(ctx);
+}
+
+int main(int argc, char **argv){
+    if(argc > 1 && strcmp(argv[1], "--bench") == 0){
+        bench_register("sum", "1024,2^20,2^24", sum_bench_setup, sum_bench_run, sum_bench_teardown);
+        int status = bench_main(argc, argv);
+        PerfPhase *phases[] = {&phase_sum};
+        perf_report(phases, 1);
+        return status;
+    }
+    if(argc < 2){
+        fprintf(stderr, "Usage: %s <num_threads> | --bench [options]\n", argv[0]);
+        return 1;
+    }
+    int num_threads = atoi(argv[1]);
+    if(num_threads <= 0){
+        fprintf(stderr, "Number of threads must be a positive integer.\n");
+        return 1;
+    }
+
+    for(int i = 0; i< N;i++){
+        numbers[i] = i + 1;
+    }
+    struct timespec start_time, end_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    long long totalSum;
+    if(parallel_sum(numbers, N, num_threads, &totalSum) != 0){
+        return 1;
+    }
     clock_gettime(CLOCK_MONOTONIC, &end_time);
     double elapsed_time = (end_time.tv_sec - start_time.tv_sec) * 1e6;
     elapsed_time += (end_time.tv_nsec - start_time.tv_nsec) / 1e3;
 
     printf("Summing array of size %d using %d threads.\n", N, num_threads);
+    topo_print_placement();
     printf("Total sum: %lld\n", totalSum);
     printf("Calculation took %.2f microseconds.\n", elapsed_time);
 
+    PerfPhase *phases[] = {&phase_sum};
+    perf_report(phases, 1);
+
     return 0;
 }
 
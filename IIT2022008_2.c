@@ -36,19 +36,32 @@ To fix this, we provided a seperate array for each thread and each thread would
 would be aggregated over all the threads. This ensures the core principle of "maximizing independent writes and minimizing shared writes"
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <math.h>
 #include <time.h>
 #include <string.h>
+#include "bench_harness.h"
+#include "perf_counters.h"
+#include "roofline.h"
+#include "topology.h"
 
 #define NUM_THREADS 4
 
+int num_threads = NUM_THREADS;
 unsigned long long limit;
 unsigned long long total_prime_count = 0;
 unsigned long long *base_primes;
 int num_base_primes = 0;
+double parallel_bytes_moved = 0; //segment traffic of the last sievePrimesParallel call, see roofline.h
+double parallel_ops = 0;
+
+PerfPhase phase_base_primes = PERF_PHASE_INIT("base primes");
+PerfPhase phase_segment_sieve = PERF_PHASE_INIT("segment sieve");
+PerfPhase phase_counting = PERF_PHASE_INIT("counting");
+PerfPhase *all_phases[] = {&phase_base_primes, &phase_segment_sieve, &phase_counting};
 
 typedef struct {
     int id;
@@ -57,10 +70,21 @@ typedef struct {
 
 void countPrimesSerial();
 void countPrimesParallel();
+int sievePrimesParallel(unsigned long long *count);
 void display(); 
 void *sieve_worker(void *arg);
+void *sieve_bench_setup(long long size, int threads);
+double sieve_bench_run(void *ctx);
+void sieve_bench_teardown(void *ctx);
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        bench_register("pthread_sieve", "2^20,2^24,2^28", sieve_bench_setup, sieve_bench_run, sieve_bench_teardown);
+        int status = bench_main(argc, argv);
+        perf_report(all_phases, 3);
+        return status;
+    }
 
-int main() {
     int n;
     printf("Enter the value of n: ");
     scanf("%d", &n);
@@ -70,6 +94,7 @@ int main() {
 
     countPrimesSerial();
     countPrimesParallel();
+    perf_report(all_phases, 3);
 
     return 0;
 }
@@ -88,11 +113,21 @@ void countPrimesSerial() {
 
     clock_gettime(CLOCK_MONOTONIC, &start);
 
+    //the memset above is not timed, so the traffic is the counting pass plus the marking, which only reaches memory
+    //when the array does not fit in the L2 (the same rule as the segments of roofline_sieve_bytes)
+    double bytes_moved = (double)limit;
+    double ops = (double)limit;
+    int marks_in_cache = (double)(limit + 1) <= ROOFLINE_CACHED_SEGMENT_BYTES;
     for (unsigned long long p = 2; p * p <= limit; p++) {
         if (isPrime[p] == 1) {
             for (unsigned long long i = p * p; i <= limit; i += p) {
                 isPrime[i] = 0;
             }
+            double marks = (double)((limit - p * p) / p + 1);
+            ops += marks;
+            if (!marks_in_cache) {
+                bytes_moved += roofline_strided_bytes(marks, (double)p);
+            }
         }
     }
 
@@ -109,20 +144,41 @@ void countPrimesSerial() {
     double time_taken = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
     printf("Serial Execution Time: %f seconds\n", time_taken);
     printf("Number of primes found: %llu\n", total_prime_count);
+    roofline_report("Serial sieve", bytes_moved, ops, "op", time_taken);
 
     free(isPrime);
 }
 
 void countPrimesParallel() {
     printf("\n Starting Parallel Count \n");
+    topo_print_placement();
     struct timespec start_time, end_time;
     clock_gettime(CLOCK_MONOTONIC, &start_time);
 
+    if (sievePrimesParallel(&total_prime_count) != 0) {
+        return;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+    double time_taken = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+    printf("Parallel Execution Time: %f seconds\n", time_taken);
+    printf("Number of primes found: %llu\n", total_prime_count);
+    roofline_report("Parallel sieve", parallel_bytes_moved, parallel_ops, "op", time_taken);
+}
+
+//counts the primes up to limit with num_threads threads into *count.
+//returns 0 on success, -1 if memory or threads could not be allocated
+int sievePrimesParallel(unsigned long long *count) {
+    PerfThreadCounters pc;
+    perf_phase_begin(&pc);
+
     unsigned long long limit_sqrt = (unsigned long long)sqrt(limit);
     char *sqrt_sieve = (char *)malloc((limit_sqrt + 1) * sizeof(char));
     if (sqrt_sieve == NULL) {
         printf("Parallel: Failed to allocate memory for base sieve.\n");
-        return;
+        perf_thread_close(&pc);
+        return -1;
     }
     memset(sqrt_sieve, 1, limit_sqrt + 1);
     sqrt_sieve[0] = sqrt_sieve[1] = 0;
@@ -145,7 +201,8 @@ void countPrimesParallel() {
     if (base_primes == NULL) {
         printf("Parallel: Failed to allocate memory for base primes array.\n");
         free(sqrt_sieve);
-        return;
+        perf_thread_close(&pc);
+        return -1;
     }
     num_base_primes = 0;
     for (unsigned long long p = 2; p <= limit_sqrt; p++) {
@@ -154,32 +211,38 @@ void countPrimesParallel() {
         }
     }
     free(sqrt_sieve); 
-    total_prime_count = base_count;
+    perf_phase_end(&pc, &phase_base_primes);
 
-    pthread_t threads[NUM_THREADS];
-    ThreadData thread_data[NUM_THREADS];
+    pthread_t threads[num_threads];
+    ThreadData thread_data[num_threads];
 
-    for (int i = 0; i < NUM_THREADS; i++) {
+    for (int i = 0; i < num_threads; i++) {
         thread_data[i].id = i;
         thread_data[i].local_count = 0;
-        if (pthread_create(&threads[i], NULL, sieve_worker, &thread_data[i]) != 0) {
-            perror("Failed to create thread");
-            return;
+        pthread_attr_t attr;
+        int created = pthread_create(&threads[i], topo_attr_for_thread(&attr, i), sieve_worker, &thread_data[i]);
+        pthread_attr_destroy(&attr);
+        if (created != 0) {
+            fprintf(stderr, "Failed to create thread: %s\n", strerror(created)); //pthread_create does not set errno
+            for (int j = 0; j < i; j++) { //the running threads still read base_primes and thread_data
+                pthread_join(threads[j], NULL);
+            }
+            free(base_primes);
+            return -1;
         }
     }
 
-    for (int i = 0; i < NUM_THREADS; i++) {
+    unsigned long long total = base_count;
+    for (int i = 0; i < num_threads; i++) {
         pthread_join(threads[i], NULL);
-        total_prime_count += thread_data[i].local_count;
+        total += thread_data[i].local_count;
     }
     
-    clock_gettime(CLOCK_MONOTONIC, &end_time);
-
-    double time_taken = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
-    printf("Parallel Execution Time: %f seconds\n", time_taken);
-    printf("Number of primes found: %llu\n", total_prime_count);
-    
+    double segment_bytes = (double)(limit - limit_sqrt) / num_threads; //one char per number, one segment per thread
+    parallel_bytes_moved = roofline_sieve_bytes(limit_sqrt + 1, limit, base_primes, num_base_primes, 1.0, segment_bytes, 0, &parallel_ops);
     free(base_primes);
+    *count = total;
+    return 0;
 }
 
 void *sieve_worker(void *arg) {
@@ -190,17 +253,27 @@ void *sieve_worker(void *arg) {
     
     unsigned long long start_num = limit_sqrt + 1;
     unsigned long long range = limit - start_num + 1;
-    unsigned long long block_size = range / NUM_THREADS;
+    unsigned long long block_size = range / num_threads;
     
     unsigned long long block_start = start_num + thread_id * block_size;
-    unsigned long long block_end = (thread_id == NUM_THREADS - 1) ? limit : block_start + block_size - 1;
+    unsigned long long block_end = (thread_id == num_threads - 1) ? limit : block_start + block_size - 1;
+    if (block_end < block_start) {
+        pthread_exit(NULL); //more threads than numbers to sieve
+    }
 
-    char *block_sieve = (char *)malloc(block_size * sizeof(char));
+    //the last thread also gets the remainder of the division, so its block can be longer than block_size
+    unsigned long long block_len = block_end - block_start + 1;
+    //allocated on the node of this (possibly pinned) thread, the memset below faults the pages in there
+    char *block_sieve = (char *)topo_alloc_local(block_len * sizeof(char));
     if(block_sieve == NULL) {
         printf("Thread %d: Failed to allocate block memory.\n", thread_id);
         pthread_exit(NULL);
     }
-    memset(block_sieve, 1, block_size);
+
+    PerfThreadCounters pc;
+    perf_thread_open(&pc);
+    perf_thread_begin(&pc);
+    memset(block_sieve, 1, block_len);
 
     for (int i = 0; i < num_base_primes; i++) {
         unsigned long long p = base_primes[i];
@@ -215,12 +288,36 @@ void *sieve_worker(void *arg) {
         }
     }
 
-    for (unsigned long long i = 0; i < (block_end - block_start + 1); i++) {
+    perf_thread_end(&pc, &phase_segment_sieve);
+
+    perf_thread_begin(&pc);
+    for (unsigned long long i = 0; i < block_len; i++) {
         if (block_sieve[i] == 1) {
             data->local_count++;
         }
     }
+    perf_thread_end(&pc, &phase_counting);
+    perf_thread_close(&pc);
     
-    free(block_sieve);
+    topo_free_local(block_sieve, block_len * sizeof(char));
     pthread_exit(NULL);
 }
+
+void *sieve_bench_setup(long long size, int threads) {
+    limit = (unsigned long long)size;
+    num_threads = threads;
+    return &limit; //the sieve works on the globals, there is no separate context
+}
+
+double sieve_bench_run(void *ctx) {
+    (void)ctx;
+    unsigned long long count;
+    if (sievePrimesParallel(&count) != 0) {
+        return NAN; //never equal to the checksum of a good run, so the harness flags it
+    }
+    return (double)count;
+}
+
+void sieve_bench_teardown(void *ctx) {
+    (void)ctx;
+}
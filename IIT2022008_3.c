@@ -41,13 +41,44 @@ converted to a CSR representation. The multiplcation algorithm is used for matri
 ensures that multiplication is only done between the non zero elements of the matrix and the vector. This is made possible
 by the CSR representation, which gives us an efficient representation of which positions in the matrix contains non zero elements.
 C1 and C2 are seen to be the same in both sequential and parallel executions. The time is recorded and printed.
+
+CACHE BLOCKED VARIANT:
+When num_cols is in the tens of millions, B no longer fits in the last level cache and every row pulls random cache lines
+of B from DRAM. C3 is computed from a column blocked copy of A: the columns are split into panels whose slice of B fits in
+half of the LLC (size from topology.h: sysfs, else sysconf), every panel keeps its own small CSR structure holding only the
+rows that have non zeros in it, and each thread accumulates the panel partial sums for its rows into C. For small matrices
+like the 138x138 one there is a single panel and C3 is the same computation as C2.
+
+TRANSPOSED PRODUCT:
+When B has one entry per row of A, D = A^T B is also computed from the same CSR matrix, without a second transposed file.
+Rows scatter into D, so the threads cannot simply split the rows. If a copy of D per thread fits in 64 MB, every thread
+scatters into its own copy and the copies are merged in parallel by column. Otherwise the rows are colored so that rows of
+the same color share no column and each color is scattered in parallel without atomics. If the coloring needs more than
+64 colors, a CSC copy of A is built once and cached in the matrix, and every thread gathers its own columns of D.
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include <time.h> 
+#include <stdint.h>
+#include "bench_harness.h"
+#include "perf_counters.h"
+#include "roofline.h"
+#include "topology.h"
+
+#define DEFAULT_LLC_BYTES (8 * 1024 * 1024)
+#define PRIVATIZE_BUDGET_BYTES (64 * 1024 * 1024) //max total size of the per thread copies of A^T x
+#define MAX_ROW_COLORS 64
+
+typedef enum {
+    TRANSPOSE_AUTO,
+    TRANSPOSE_PRIVATIZED, //every thread scatters into its own copy of y, then the copies are merged in parallel
+    TRANSPOSE_COLORED, //rows of one color share no columns, so they can scatter into y without atomics
+    TRANSPOSE_CSC //every thread gathers its own columns of y from the cached CSC copy
+} TransposeMode;
 
 typedef struct {
     int num_rows;
@@ -56,16 +87,80 @@ typedef struct {
     double *values;
     int *col_indices;
     int *row_pointers;
+
+    //caches used by multiply_transpose, they stay NULL until they are first needed
+    int *csc_col_pointers;
+    int *csc_row_indices;
+    double *csc_values;
+    int num_colors; //0 = coloring not computed yet, -1 = more than MAX_ROW_COLORS colors are needed
+    int *color_pointers; //num_colors + 1 entries into color_rows
+    int *color_rows; //row indices grouped by color
 } SparseMatrixCSR;
 
+//one column panel of the blocked matrix. only rows with at least one non zero inside
+//the panel are stored, so the total size of all panels stays O(nnz) instead of O(num_panels * num_rows)
+typedef struct {
+    int col_start;
+    int col_end;
+    int num_panel_rows;
+    int *row_ids; //global row index of each stored row, sorted ascending
+    int *row_pointers; //num_panel_rows + 1 entries into values/col_indices
+    int *col_indices;
+    double *values;
+} CSRPanel;
+
+typedef struct {
+    int num_rows;
+    int num_cols;
+    int panel_width;
+    int num_panels;
+    CSRPanel *panels;
+} SparseMatrixBlockedCSR;
+
+//copy of the rows [start_row, end_row) of A that one thread multiplies, allocated on the NUMA node of that thread.
+//row_pointers keeps the values of A, so entry j of the row is at col_indices[j - row_pointers[0]]
+typedef struct {
+    int start_row;
+    int end_row;
+    int *row_pointers;
+    int *col_indices;
+    double *values;
+} CSRRowSlice;
+
 typedef struct {
     int thread_id;
     int num_threads;
     const SparseMatrixCSR *A;
+    const CSRRowSlice *slice; //node local rows of this thread, NULL to read them from A
     const double *B;
     double *C;
 } ThreadData;
 
+typedef struct {
+    int thread_id;
+    int num_threads;
+    const SparseMatrixBlockedCSR *A;
+    const double *B;
+    double *C;
+} BlockedThreadData;
+
+typedef struct {
+    int thread_id;
+    int num_threads;
+    TransposeMode mode;
+    const SparseMatrixCSR *A;
+    const double *x;
+    double *y;
+    double *private_y; //num_threads * num_cols doubles, only used by TRANSPOSE_PRIVATIZED
+    pthread_barrier_t *barrier;
+} TransposeThreadData;
+
+PerfPhase phase_csr_build = PERF_PHASE_INIT("CSR build");
+PerfPhase phase_spmv = PERF_PHASE_INIT("SpMV");
+PerfPhase phase_spmv_blocked = PERF_PHASE_INIT("SpMV blocked");
+PerfPhase phase_spmv_transpose = PERF_PHASE_INIT("SpMV transpose");
+PerfPhase *all_phases[] = {&phase_csr_build, &phase_spmv, &phase_spmv_blocked, &phase_spmv_transpose};
+
 SparseMatrixCSR read_and_convert_to_csr(const char *filename) {
     FILE *file = fopen(filename, "r");
     if (!file) {
@@ -90,6 +185,12 @@ SparseMatrixCSR read_and_convert_to_csr(const char *filename) {
     A.values = (double *)malloc(num_non_zeros * sizeof(double));
     A.col_indices = (int *)malloc(num_non_zeros * sizeof(int));
     A.row_pointers = (int *)calloc(num_rows + 1, sizeof(int));
+    A.csc_col_pointers = NULL;
+    A.csc_row_indices = NULL;
+    A.csc_values = NULL;
+    A.num_colors = 0;
+    A.color_pointers = NULL;
+    A.color_rows = NULL;
 
     if (!A.values || !A.col_indices || !A.row_pointers) {
         fprintf(stderr, "Memory allocation failed for CSR matrix.\n");
@@ -119,6 +220,9 @@ SparseMatrixCSR read_and_convert_to_csr(const char *filename) {
 
     fclose(file);
 
+    //only the COO to CSR conversion is counted, not the file parsing
+    PerfThreadCounters pc;
+    perf_phase_begin(&pc);
     for (int i = 0; i < num_rows; ++i) {
         A.row_pointers[i + 1] += A.row_pointers[i];
     }
@@ -143,6 +247,7 @@ SparseMatrixCSR read_and_convert_to_csr(const char *filename) {
     free(coo_cols);
     free(coo_vals);
     free(row_counts);
+    perf_phase_end(&pc, &phase_csr_build);
 
     return A;
 }
@@ -205,18 +310,612 @@ void* multiply_parallel_thread_func(void* arg) {
         end_row = data->A->num_rows;
     }
 
+    const int *row_pointers = data->A->row_pointers;
+    const int *col_indices = data->A->col_indices;
+    const double *values = data->A->values;
+    int row_offset = 0, nnz_offset = 0;
+    if (data->slice) {
+        row_pointers = data->slice->row_pointers;
+        col_indices = data->slice->col_indices;
+        values = data->slice->values;
+        row_offset = start_row;
+        nnz_offset = data->slice->row_pointers[0];
+    }
+
+    PerfThreadCounters pc;
+    perf_phase_begin(&pc);
     for (int i = start_row; i < end_row; ++i) {
         data->C[i] = 0.0;
-        int start_idx = data->A->row_pointers[i];
-        int end_idx = data->A->row_pointers[i + 1];
+        int start_idx = row_pointers[i - row_offset] - nnz_offset;
+        int end_idx = row_pointers[i - row_offset + 1] - nnz_offset;
         for (int j = start_idx; j < end_idx; ++j) {
-            data->C[i] += data->A->values[j] * data->B[data->A->col_indices[j]];
+            data->C[i] += values[j] * data->B[col_indices[j]];
+        }
+    }
+    perf_phase_end(&pc, &phase_spmv);
+
+    pthread_exit(NULL);
+}
+
+//half of the LLC is reserved for the slice of B, the other half is left for the streamed
+//values/col_indices and for C. the LLC size comes from topology.h, DEFAULT_LLC_BYTES if sysfs does not have it
+int choose_panel_width(int num_cols) {
+    long llc = topo_get()->llc_bytes > 0 ? topo_get()->llc_bytes : DEFAULT_LLC_BYTES;
+    long width = llc / 2 / (long)sizeof(double);
+    if (width < 1024) {
+        width = 1024;
+    }
+    if (width > num_cols) {
+        width = num_cols;
+    }
+    return width > 0 ? (int)width : 1;
+}
+
+//splits A into column panels of panel_width columns each. within a panel the entries of a
+//row keep their CSR order because col_indices are visited in row order
+SparseMatrixBlockedCSR build_blocked_csr(const SparseMatrixCSR *A, int panel_width) {
+    SparseMatrixBlockedCSR Ab;
+    Ab.num_rows = A->num_rows;
+    Ab.num_cols = A->num_cols;
+    Ab.panel_width = panel_width;
+    Ab.num_panels = (A->num_cols + panel_width - 1) / panel_width;
+    if (Ab.num_panels == 0) {
+        Ab.num_panels = 1;
+    }
+    Ab.panels = (CSRPanel *)calloc(Ab.num_panels, sizeof(CSRPanel));
+
+    int *panel_nnz = (int *)calloc(Ab.num_panels, sizeof(int));
+    int *panel_rows = (int *)calloc(Ab.num_panels, sizeof(int));
+    int *last_row = (int *)malloc(Ab.num_panels * sizeof(int));
+    if (!Ab.panels || !panel_nnz || !panel_rows || !last_row) {
+        fprintf(stderr, "Memory allocation failed for blocked CSR matrix.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int p = 0; p < Ab.num_panels; ++p) {
+        last_row[p] = -1;
+    }
+
+    //first pass counts non zeros and non empty rows per panel
+    for (int i = 0; i < A->num_rows; ++i) {
+        for (int j = A->row_pointers[i]; j < A->row_pointers[i + 1]; ++j) {
+            int p = A->col_indices[j] / panel_width;
+            panel_nnz[p]++;
+            if (last_row[p] != i) {
+                last_row[p] = i;
+                panel_rows[p]++;
+            }
+        }
+    }
+
+    for (int p = 0; p < Ab.num_panels; ++p) {
+        CSRPanel *panel = &Ab.panels[p];
+        panel->col_start = p * panel_width;
+        panel->col_end = (p == Ab.num_panels - 1) ? A->num_cols : panel->col_start + panel_width;
+        panel->num_panel_rows = 0;
+        panel->row_ids = (int *)malloc((panel_rows[p] + 1) * sizeof(int));
+        panel->row_pointers = (int *)malloc((panel_rows[p] + 1) * sizeof(int));
+        panel->col_indices = (int *)malloc((panel_nnz[p] + 1) * sizeof(int));
+        panel->values = (double *)malloc((panel_nnz[p] + 1) * sizeof(double));
+        if (!panel->row_ids || !panel->row_pointers || !panel->col_indices || !panel->values) {
+            fprintf(stderr, "Memory allocation failed for CSR panel.\n");
+            exit(EXIT_FAILURE);
+        }
+        panel->row_pointers[0] = 0;
+        last_row[p] = -1;
+    }
+
+    //second pass scatters the entries into their panels
+    for (int i = 0; i < A->num_rows; ++i) {
+        for (int j = A->row_pointers[i]; j < A->row_pointers[i + 1]; ++j) {
+            int p = A->col_indices[j] / panel_width;
+            CSRPanel *panel = &Ab.panels[p];
+            if (last_row[p] != i) {
+                last_row[p] = i;
+                panel->row_ids[panel->num_panel_rows] = i;
+                panel->num_panel_rows++;
+                panel->row_pointers[panel->num_panel_rows] = panel->row_pointers[panel->num_panel_rows - 1];
+            }
+            int pos = panel->row_pointers[panel->num_panel_rows]++;
+            panel->col_indices[pos] = A->col_indices[j];
+            panel->values[pos] = A->values[j];
+        }
+    }
+
+    free(panel_nnz);
+    free(panel_rows);
+    free(last_row);
+    return Ab;
+}
+
+void free_blocked_csr(SparseMatrixBlockedCSR *Ab) {
+    for (int p = 0; p < Ab->num_panels; ++p) {
+        free(Ab->panels[p].row_ids);
+        free(Ab->panels[p].row_pointers);
+        free(Ab->panels[p].col_indices);
+        free(Ab->panels[p].values);
+    }
+    free(Ab->panels);
+    Ab->panels = NULL;
+    Ab->num_panels = 0;
+}
+
+//index of the first stored row of the panel that is >= row
+int panel_lower_bound(const CSRPanel *panel, int row) {
+    int lo = 0, hi = panel->num_panel_rows;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (panel->row_ids[mid] < row) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void* multiply_blocked_thread_func(void* arg) {
+    BlockedThreadData *data = (BlockedThreadData *)arg;
+    const SparseMatrixBlockedCSR *A = data->A;
+
+    int start_row = data->thread_id * (A->num_rows / data->num_threads);
+    int end_row = start_row + (A->num_rows / data->num_threads);
+    if (data->thread_id == data->num_threads - 1) {
+        end_row = A->num_rows;
+    }
+
+    PerfThreadCounters pc;
+    perf_phase_begin(&pc);
+    for (int i = start_row; i < end_row; ++i) {
+        data->C[i] = 0.0;
+    }
+
+    //all threads walk the panels in the same order, so the slice of B for the current
+    //panel is shared in the LLC instead of being pulled from DRAM by every row
+    for (int p = 0; p < A->num_panels; ++p) {
+        const CSRPanel *panel = &A->panels[p];
+        for (int r = panel_lower_bound(panel, start_row); r < panel->num_panel_rows && panel->row_ids[r] < end_row; ++r) {
+            double sum = 0.0;
+            for (int j = panel->row_pointers[r]; j < panel->row_pointers[r + 1]; ++j) {
+                sum += panel->values[j] * data->B[panel->col_indices[j]];
+            }
+            data->C[panel->row_ids[r]] += sum;
+        }
+    }
+    perf_phase_end(&pc, &phase_spmv_blocked);
+
+    pthread_exit(NULL);
+}
+
+typedef struct {
+    const SparseMatrixCSR *A;
+    CSRRowSlice *slice;
+} SliceCopyData;
+
+void* copy_row_slice_thread_func(void* arg) {
+    SliceCopyData *data = (SliceCopyData *)arg;
+    CSRRowSlice *slice = data->slice;
+    const SparseMatrixCSR *A = data->A;
+    int num_slice_rows = slice->end_row - slice->start_row;
+    int first = A->row_pointers[slice->start_row];
+    int nnz = A->row_pointers[slice->end_row] - first;
+
+    //the copies below are the first writes, so the pages land on the node of this pinned thread
+    slice->row_pointers = (int *)topo_alloc_local((num_slice_rows + 1) * sizeof(int));
+    slice->col_indices = (int *)topo_alloc_local(nnz * sizeof(int));
+    slice->values = (double *)topo_alloc_local(nnz * sizeof(double));
+    if (!slice->row_pointers || !slice->col_indices || !slice->values) {
+        fprintf(stderr, "Memory allocation failed for CSR row slice.\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(slice->row_pointers, &A->row_pointers[slice->start_row], (num_slice_rows + 1) * sizeof(int));
+    memcpy(slice->col_indices, &A->col_indices[first], nnz * sizeof(int));
+    memcpy(slice->values, &A->values[first], nnz * sizeof(double));
+    pthread_exit(NULL);
+}
+
+//node local copies of the row ranges multiply_parallel gives to each thread, copied by threads pinned exactly
+//like the multiplying ones. only worth it when PDC_PLACEMENT pins the threads
+CSRRowSlice* distribute_csr_rows(const SparseMatrixCSR *A, int num_threads) {
+    CSRRowSlice *slices = (CSRRowSlice *)malloc(num_threads * sizeof(CSRRowSlice));
+    SliceCopyData *copy_data = (SliceCopyData *)malloc(num_threads * sizeof(SliceCopyData));
+    pthread_t *threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+    if (!slices || !copy_data || !threads) {
+        fprintf(stderr, "Memory allocation failed for CSR row slices.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < num_threads; ++i) {
+        slices[i].start_row = i * (A->num_rows / num_threads);
+        slices[i].end_row = slices[i].start_row + (A->num_rows / num_threads);
+        if (i == num_threads - 1) {
+            slices[i].end_row = A->num_rows;
+        }
+        copy_data[i].A = A;
+        copy_data[i].slice = &slices[i];
+        pthread_attr_t attr;
+        pthread_create(&threads[i], topo_attr_for_thread(&attr, i), copy_row_slice_thread_func, &copy_data[i]);
+        pthread_attr_destroy(&attr);
+    }
+    for (int i = 0; i < num_threads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(copy_data);
+    free(threads);
+    return slices;
+}
+
+void free_row_slices(CSRRowSlice *slices, int num_threads) {
+    if (!slices) {
+        return;
+    }
+    for (int i = 0; i < num_threads; ++i) {
+        int num_slice_rows = slices[i].end_row - slices[i].start_row;
+        int nnz = slices[i].row_pointers[num_slice_rows] - slices[i].row_pointers[0];
+        topo_free_local(slices[i].row_pointers, (num_slice_rows + 1) * sizeof(int));
+        topo_free_local(slices[i].col_indices, nnz * sizeof(int));
+        topo_free_local(slices[i].values, nnz * sizeof(double));
+    }
+    free(slices);
+}
+
+//C = A B with num_threads threads, each thread gets a contiguous range of rows. slices are the node local
+//copies of those rows from distribute_csr_rows, or NULL to read the rows from A
+void multiply_parallel(const SparseMatrixCSR *A, const CSRRowSlice *slices, const double *B, double *C, int num_threads) {
+    pthread_t *threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t)); //initialize threads
+    ThreadData *thread_data_array = (ThreadData*)malloc(num_threads * sizeof(ThreadData)); //initialize thread data
+    if (!threads || !thread_data_array) {
+        fprintf(stderr, "Memory allocation failed for threads or thread data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < num_threads; ++i) {
+        thread_data_array[i].thread_id = i;
+        thread_data_array[i].num_threads = num_threads;
+        thread_data_array[i].A = A;
+        thread_data_array[i].slice = slices ? &slices[i] : NULL;
+        thread_data_array[i].B = B;
+        thread_data_array[i].C = C;
+        pthread_attr_t attr;
+        pthread_create(&threads[i], topo_attr_for_thread(&attr, i), multiply_parallel_thread_func, &thread_data_array[i]);
+        pthread_attr_destroy(&attr);
+    }
+
+    //join threads
+    for (int i = 0; i < num_threads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(thread_data_array);
+}
+
+//C = A B from the column blocked copy of A, same row split as multiply_parallel
+void multiply_blocked(const SparseMatrixBlockedCSR *Ab, const double *B, double *C, int num_threads) {
+    pthread_t *threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+    BlockedThreadData *blocked_data_array = (BlockedThreadData*)malloc(num_threads * sizeof(BlockedThreadData));
+    if (!threads || !blocked_data_array) {
+        fprintf(stderr, "Memory allocation failed for threads or thread data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < num_threads; ++i) {
+        blocked_data_array[i].thread_id = i;
+        blocked_data_array[i].num_threads = num_threads;
+        blocked_data_array[i].A = Ab;
+        blocked_data_array[i].B = B;
+        blocked_data_array[i].C = C;
+        pthread_attr_t attr;
+        pthread_create(&threads[i], topo_attr_for_thread(&attr, i), multiply_blocked_thread_func, &blocked_data_array[i]);
+        pthread_attr_destroy(&attr);
+    }
+
+    for (int i = 0; i < num_threads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(blocked_data_array);
+}
+
+void multiply_transpose_sequential(const SparseMatrixCSR *A, const double *x, double *y) {
+    for (int j = 0; j < A->num_cols; ++j) {
+        y[j] = 0.0;
+    }
+    for (int i = 0; i < A->num_rows; ++i) {
+        for (int j = A->row_pointers[i]; j < A->row_pointers[i + 1]; ++j) {
+            y[A->col_indices[j]] += A->values[j] * x[i];
+        }
+    }
+}
+
+//builds the CSC copy of A the first time it is asked for, later calls reuse it
+void ensure_csc(SparseMatrixCSR *A) {
+    if (A->csc_col_pointers) {
+        return;
+    }
+    A->csc_col_pointers = (int *)calloc(A->num_cols + 1, sizeof(int));
+    A->csc_row_indices = (int *)malloc((A->num_non_zeros + 1) * sizeof(int));
+    A->csc_values = (double *)malloc((A->num_non_zeros + 1) * sizeof(double));
+    int *col_counts = (int *)calloc(A->num_cols + 1, sizeof(int));
+    if (!A->csc_col_pointers || !A->csc_row_indices || !A->csc_values || !col_counts) {
+        fprintf(stderr, "Memory allocation failed for CSC copy.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int j = 0; j < A->num_non_zeros; ++j) {
+        A->csc_col_pointers[A->col_indices[j] + 1]++;
+    }
+    for (int c = 0; c < A->num_cols; ++c) {
+        A->csc_col_pointers[c + 1] += A->csc_col_pointers[c];
+    }
+    for (int i = 0; i < A->num_rows; ++i) {
+        for (int j = A->row_pointers[i]; j < A->row_pointers[i + 1]; ++j) {
+            int c = A->col_indices[j];
+            int pos = A->csc_col_pointers[c] + col_counts[c]++;
+            A->csc_row_indices[pos] = i;
+            A->csc_values[pos] = A->values[j];
+        }
+    }
+    free(col_counts);
+}
+
+//greedy distance-2 coloring of the rows: two rows get the same color only if they have no column in
+//common. every column remembers the colors already used by its rows in a 64 bit mask, so the coloring
+//is a single O(nnz) pass. returns 0 if some row would need more than MAX_ROW_COLORS colors
+int ensure_row_coloring(SparseMatrixCSR *A) {
+    if (A->num_colors != 0) {
+        return A->num_colors > 0;
+    }
+
+    uint64_t *col_masks = (uint64_t *)calloc(A->num_cols, sizeof(uint64_t));
+    int *row_color = (int *)malloc((A->num_rows + 1) * sizeof(int));
+    if (!col_masks || !row_color) {
+        fprintf(stderr, "Memory allocation failed for row coloring.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int num_colors = 0;
+    for (int i = 0; i < A->num_rows; ++i) {
+        uint64_t used = 0;
+        for (int j = A->row_pointers[i]; j < A->row_pointers[i + 1]; ++j) {
+            used |= col_masks[A->col_indices[j]];
+        }
+        if (used == UINT64_MAX) {
+            free(col_masks);
+            free(row_color);
+            A->num_colors = -1;
+            return 0;
+        }
+        int color = __builtin_ctzll(~used);
+        for (int j = A->row_pointers[i]; j < A->row_pointers[i + 1]; ++j) {
+            col_masks[A->col_indices[j]] |= 1ULL << color;
+        }
+        row_color[i] = color;
+        if (color + 1 > num_colors) {
+            num_colors = color + 1;
+        }
+    }
+    if (num_colors == 0) {
+        num_colors = 1; //matrix without rows
+    }
+
+    A->color_pointers = (int *)calloc(num_colors + 1, sizeof(int));
+    A->color_rows = (int *)malloc((A->num_rows + 1) * sizeof(int));
+    if (!A->color_pointers || !A->color_rows) {
+        fprintf(stderr, "Memory allocation failed for row coloring.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < A->num_rows; ++i) {
+        A->color_pointers[row_color[i] + 1]++;
+    }
+    for (int c = 0; c < num_colors; ++c) {
+        A->color_pointers[c + 1] += A->color_pointers[c];
+    }
+    int *fill = (int *)calloc(num_colors, sizeof(int));
+    if (!fill) {
+        fprintf(stderr, "Memory allocation failed for row coloring.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < A->num_rows; ++i) {
+        A->color_rows[A->color_pointers[row_color[i]] + fill[row_color[i]]++] = i;
+    }
+
+    free(fill);
+    free(col_masks);
+    free(row_color);
+    A->num_colors = num_colors;
+    return 1;
+}
+
+//splits [0, n) evenly between the threads the same way multiply_parallel_thread_func splits the rows
+void thread_range(int n, int thread_id, int num_threads, int *start, int *end) {
+    *start = thread_id * (n / num_threads);
+    *end = *start + (n / num_threads);
+    if (thread_id == num_threads - 1) {
+        *end = n;
+    }
+}
+
+void* multiply_transpose_thread_func(void* arg) {
+    TransposeThreadData *data = (TransposeThreadData *)arg;
+    const SparseMatrixCSR *A = data->A;
+    int start_row, end_row, start_col, end_col;
+    thread_range(A->num_rows, data->thread_id, data->num_threads, &start_row, &end_row);
+    thread_range(A->num_cols, data->thread_id, data->num_threads, &start_col, &end_col);
+
+    PerfThreadCounters pc;
+    perf_phase_begin(&pc);
+    if (data->mode == TRANSPOSE_PRIVATIZED) {
+        double *my_y = data->private_y + (size_t)data->thread_id * A->num_cols;
+        memset(my_y, 0, A->num_cols * sizeof(double));
+        for (int i = start_row; i < end_row; ++i) {
+            for (int j = A->row_pointers[i]; j < A->row_pointers[i + 1]; ++j) {
+                my_y[A->col_indices[j]] += A->values[j] * data->x[i];
+            }
+        }
+        pthread_barrier_wait(data->barrier);
+
+        //parallel merge, every thread adds up all the private copies for its own columns
+        for (int c = start_col; c < end_col; ++c) {
+            double sum = 0.0;
+            for (int t = 0; t < data->num_threads; ++t) {
+                sum += data->private_y[(size_t)t * A->num_cols + c];
+            }
+            data->y[c] = sum;
+        }
+    } else if (data->mode == TRANSPOSE_COLORED) {
+        for (int c = start_col; c < end_col; ++c) {
+            data->y[c] = 0.0;
+        }
+        pthread_barrier_wait(data->barrier);
+
+        for (int color = 0; color < A->num_colors; ++color) {
+            int first = A->color_pointers[color];
+            int start, end;
+            thread_range(A->color_pointers[color + 1] - first, data->thread_id, data->num_threads, &start, &end);
+            for (int r = first + start; r < first + end; ++r) {
+                int i = A->color_rows[r];
+                for (int j = A->row_pointers[i]; j < A->row_pointers[i + 1]; ++j) {
+                    data->y[A->col_indices[j]] += A->values[j] * data->x[i];
+                }
+            }
+            pthread_barrier_wait(data->barrier);
+        }
+    } else {
+        for (int c = start_col; c < end_col; ++c) {
+            double sum = 0.0;
+            for (int j = A->csc_col_pointers[c]; j < A->csc_col_pointers[c + 1]; ++j) {
+                sum += A->csc_values[j] * data->x[A->csc_row_indices[j]];
+            }
+            data->y[c] = sum;
         }
     }
+    perf_phase_end(&pc, &phase_spmv_transpose);
 
     pthread_exit(NULL);
 }
 
+//y = A^T x with num_threads threads, x has num_rows entries and y has num_cols entries.
+//TRANSPOSE_AUTO privatizes y while the per thread copies fit in PRIVATIZE_BUDGET_BYTES, otherwise it
+//colors the rows, and falls back to the CSC copy when the coloring needs too many colors
+//(e.g. a dense column). returns the mode that was actually used
+TransposeMode multiply_transpose(SparseMatrixCSR *A, const double *x, double *y, int num_threads, TransposeMode mode) {
+    if (mode == TRANSPOSE_AUTO) {
+        size_t private_bytes = (size_t)num_threads * A->num_cols * sizeof(double);
+        mode = private_bytes <= PRIVATIZE_BUDGET_BYTES ? TRANSPOSE_PRIVATIZED : TRANSPOSE_COLORED;
+    }
+    if (mode == TRANSPOSE_COLORED && !ensure_row_coloring(A)) {
+        mode = TRANSPOSE_CSC;
+    }
+    if (mode == TRANSPOSE_CSC) {
+        ensure_csc(A);
+    }
+
+    double *private_y = NULL;
+    if (mode == TRANSPOSE_PRIVATIZED) {
+        private_y = (double *)malloc((size_t)num_threads * A->num_cols * sizeof(double) + 1);
+        if (!private_y) {
+            fprintf(stderr, "Memory allocation failed for private copies of y.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_t *threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+    TransposeThreadData *thread_data = (TransposeThreadData *)malloc(num_threads * sizeof(TransposeThreadData));
+    if (!threads || !thread_data) {
+        fprintf(stderr, "Memory allocation failed for transpose threads.\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, num_threads);
+
+    for (int i = 0; i < num_threads; ++i) {
+        thread_data[i].thread_id = i;
+        thread_data[i].num_threads = num_threads;
+        thread_data[i].mode = mode;
+        thread_data[i].A = A;
+        thread_data[i].x = x;
+        thread_data[i].y = y;
+        thread_data[i].private_y = private_y;
+        thread_data[i].barrier = &barrier;
+        pthread_attr_t attr;
+        pthread_create(&threads[i], topo_attr_for_thread(&attr, i), multiply_transpose_thread_func, &thread_data[i]);
+        pthread_attr_destroy(&attr);
+    }
+    for (int i = 0; i < num_threads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_barrier_destroy(&barrier);
+    free(threads);
+    free(thread_data);
+    free(private_y);
+    return mode;
+}
+
+const char *transpose_mode_name(TransposeMode mode) {
+    switch (mode) {
+        case TRANSPOSE_PRIVATIZED: return "privatized";
+        case TRANSPOSE_COLORED: return "row colored";
+        case TRANSPOSE_CSC: return "cached CSC";
+        default: return "auto";
+    }
+}
+
+//traffic models for roofline_report: every array is streamed once, B is read once per column
+//(its compulsory traffic) and C is written once per row
+double spmv_bytes_moved(const SparseMatrixCSR *A) {
+    return (A->num_rows + 1.0) * sizeof(int)
+         + (double)A->num_non_zeros * (sizeof(int) + sizeof(double))
+         + (double)A->num_cols * sizeof(double)
+         + (double)A->num_rows * sizeof(double);
+}
+
+//every panel streams its own row_ids/row_pointers/col_indices/values and its slice of B, and reads
+//and writes C once per stored row
+double blocked_bytes_moved(const SparseMatrixBlockedCSR *Ab) {
+    double bytes = (double)Ab->num_rows * sizeof(double) + (double)Ab->num_cols * sizeof(double);
+    for (int p = 0; p < Ab->num_panels; ++p) {
+        const CSRPanel *panel = &Ab->panels[p];
+        int nnz = panel->row_pointers[panel->num_panel_rows];
+        bytes += (2.0 * panel->num_panel_rows + 1.0) * sizeof(int)
+               + (double)nnz * (sizeof(int) + sizeof(double))
+               + 2.0 * panel->num_panel_rows * sizeof(double);
+    }
+    return bytes;
+}
+
+//the sequential loop streams the CSR arrays and x, zeroes y and then updates it in place
+double transpose_sequential_bytes_moved(const SparseMatrixCSR *A) {
+    return (A->num_rows + 1.0) * sizeof(int)
+         + (double)A->num_non_zeros * (sizeof(int) + sizeof(double))
+         + (double)A->num_rows * sizeof(double)
+         + 2.0 * A->num_cols * sizeof(double);
+}
+
+double transpose_bytes_moved(const SparseMatrixCSR *A, TransposeMode mode, int num_threads) {
+    double matrix = (double)A->num_non_zeros * (sizeof(int) + sizeof(double));
+    double x = (double)A->num_rows * sizeof(double);
+    double y = (double)A->num_cols * sizeof(double);
+    if (mode == TRANSPOSE_CSC) {
+        return matrix + (A->num_cols + 1.0) * sizeof(int) + x + y;
+    }
+    matrix += (A->num_rows + 1.0) * sizeof(int);
+    if (mode == TRANSPOSE_PRIVATIZED) {
+        return matrix + x + 2.0 * num_threads * y + y; //private copies written, read back by the merge
+    }
+    return matrix + x + 2.0 * y + (A->num_rows + 1.0) * sizeof(int); //y zeroed then updated, plus color_rows
+}
+
+void free_matrix_csr(SparseMatrixCSR *A) {
+    free(A->values);
+    free(A->col_indices);
+    free(A->row_pointers);
+    free(A->csc_col_pointers);
+    free(A->csc_row_indices);
+    free(A->csc_values);
+    free(A->color_pointers);
+    free(A->color_rows);
+}
+
 void print_matrix_csr(const SparseMatrixCSR *A, int num_threads) {
     printf("\n#Rows: %d\n", A->num_rows);
     printf("#Cols: %d\n", A->num_cols);
@@ -243,9 +942,125 @@ void print_matrix_csr(const SparseMatrixCSR *A, int num_threads) {
     printf("\n\n");
 }
 
+//random square matrix with nnz_per_row entries per row at random columns, used by the benchmark
+//so the sweep does not depend on a matrix file. columns inside a row are kept sorted like in the .mtx input
+SparseMatrixCSR generate_random_csr(int n, int nnz_per_row, unsigned int seed) {
+    SparseMatrixCSR A;
+    A.num_rows = n;
+    A.num_cols = n;
+    A.num_non_zeros = n * nnz_per_row;
+    A.values = (double *)malloc((A.num_non_zeros + 1) * sizeof(double));
+    A.col_indices = (int *)malloc((A.num_non_zeros + 1) * sizeof(int));
+    A.row_pointers = (int *)malloc((n + 1) * sizeof(int));
+    A.csc_col_pointers = NULL;
+    A.csc_row_indices = NULL;
+    A.csc_values = NULL;
+    A.num_colors = 0;
+    A.color_pointers = NULL;
+    A.color_rows = NULL;
+    if (!A.values || !A.col_indices || !A.row_pointers) {
+        fprintf(stderr, "Memory allocation failed for CSR matrix.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i <= n; ++i) {
+        A.row_pointers[i] = i * nnz_per_row;
+    }
+    for (int i = 0; i < n; ++i) {
+        int *cols = &A.col_indices[A.row_pointers[i]];
+        for (int k = 0; k < nnz_per_row; ++k) {
+            int col = rand_r(&seed) % n;
+            int pos = k;
+            while (pos > 0 && cols[pos - 1] > col) { //insertion sort, rows are short
+                cols[pos] = cols[pos - 1];
+                pos--;
+            }
+            cols[pos] = col;
+            A.values[A.row_pointers[i] + k] = (double)rand_r(&seed) / RAND_MAX - 0.5;
+        }
+    }
+    return A;
+}
+
+typedef struct {
+    SparseMatrixCSR A;
+    SparseMatrixBlockedCSR Ab;
+    CSRRowSlice *slices;
+    double *B;
+    double *C;
+    int num_threads;
+} SpmvBench;
+
+#define SPMV_BENCH_NNZ_PER_ROW 8
+
+void* spmv_bench_setup(long long size, int num_threads) {
+    SpmvBench *ctx = (SpmvBench *)malloc(sizeof(SpmvBench));
+    if (!ctx) {
+        return NULL;
+    }
+    ctx->A = generate_random_csr((int)size, SPMV_BENCH_NNZ_PER_ROW, 12345);
+    ctx->Ab = build_blocked_csr(&ctx->A, choose_panel_width(ctx->A.num_cols));
+    ctx->slices = topo_policy() != TOPO_NONE ? distribute_csr_rows(&ctx->A, num_threads) : NULL;
+    ctx->B = (double *)malloc(size * sizeof(double));
+    ctx->C = (double *)malloc(size * sizeof(double));
+    if (!ctx->B || !ctx->C) {
+        fprintf(stderr, "Memory allocation failed for benchmark vectors.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (long long i = 0; i < size; ++i) {
+        ctx->B[i] = 1.0 + (double)(i % 7);
+    }
+    ctx->num_threads = num_threads;
+    return ctx;
+}
+
+double spmv_bench_checksum(const SpmvBench *ctx) {
+    double sum = 0.0;
+    for (int i = 0; i < ctx->A.num_rows; ++i) {
+        sum += ctx->C[i];
+    }
+    return sum;
+}
+
+double spmv_bench_run_csr(void *arg) {
+    SpmvBench *ctx = (SpmvBench *)arg;
+    multiply_parallel(&ctx->A, ctx->slices, ctx->B, ctx->C, ctx->num_threads);
+    return spmv_bench_checksum(ctx);
+}
+
+double spmv_bench_run_blocked(void *arg) {
+    SpmvBench *ctx = (SpmvBench *)arg;
+    multiply_blocked(&ctx->Ab, ctx->B, ctx->C, ctx->num_threads);
+    return spmv_bench_checksum(ctx);
+}
+
+double spmv_bench_run_transpose(void *arg) {
+    SpmvBench *ctx = (SpmvBench *)arg;
+    multiply_transpose(&ctx->A, ctx->B, ctx->C, ctx->num_threads, TRANSPOSE_AUTO);
+    return spmv_bench_checksum(ctx);
+}
+
+void spmv_bench_teardown(void *arg) {
+    SpmvBench *ctx = (SpmvBench *)arg;
+    free_matrix_csr(&ctx->A);
+    free_blocked_csr(&ctx->Ab);
+    free_row_slices(ctx->slices, ctx->num_threads);
+    free(ctx->B);
+    free(ctx->C);
+    free(ctx);
+}
+
 int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        bench_register("spmv_csr", "2^16,2^20,2^22", spmv_bench_setup, spmv_bench_run_csr, spmv_bench_teardown);
+        bench_register("spmv_blocked", "2^16,2^20,2^22", spmv_bench_setup, spmv_bench_run_blocked, spmv_bench_teardown);
+        bench_register("spmv_transpose", "2^16,2^20,2^22", spmv_bench_setup, spmv_bench_run_transpose, spmv_bench_teardown);
+        int status = bench_main(argc, argv);
+        perf_report(all_phases, 4);
+        return status;
+    }
     if (argc != 4) {
-        fprintf(stderr, "Usage: %s <matrix_file.mtx> <vector_file.txt> <num_threads>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <matrix_file.mtx> <vector_file.txt> <num_threads> | --bench [options]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
@@ -289,28 +1104,13 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Memory allocation failed for C2.\n");
         exit(EXIT_FAILURE);
     }
-    pthread_t *threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t)); //initialize threads
-    ThreadData *thread_data_array = (ThreadData*)malloc(num_threads * sizeof(ThreadData)); //initialize thread data
-    if (!threads || !thread_data_array) {
-        fprintf(stderr, "Memory allocation failed for threads or thread data.\n");
-        exit(EXIT_FAILURE);
-    }
+    //with thread pinning every thread also gets a node local copy of its rows, made before the timing starts
+    CSRRowSlice *slices = topo_policy() != TOPO_NONE ? distribute_csr_rows(&A, num_threads) : NULL;
+    topo_print_placement();
 
     struct timespec start_par, end_par;
     clock_gettime(CLOCK_MONOTONIC, &start_par);
-    for (int i = 0; i < num_threads; ++i) {
-        thread_data_array[i].thread_id = i;
-        thread_data_array[i].num_threads = num_threads;
-        thread_data_array[i].A = &A;
-        thread_data_array[i].B = B;
-        thread_data_array[i].C = C2;
-        pthread_create(&threads[i], NULL, multiply_parallel_thread_func, &thread_data_array[i]);
-    }
-
-    //join threads
-    for (int i = 0; i < num_threads; ++i) {
-        pthread_join(threads[i], NULL);
-    }
+    multiply_parallel(&A, slices, B, C2, num_threads);
     clock_gettime(CLOCK_MONOTONIC, &end_par);
     double par_time = (end_par.tv_sec - start_par.tv_sec) + (end_par.tv_nsec - start_par.tv_nsec) / 1e9;
 
@@ -320,17 +1120,80 @@ int main(int argc, char *argv[]) {
     }
     printf("\n\n");
     
+    //cache blocked parallel computation
+    double* C3 = (double*)calloc(A.num_rows, sizeof(double));
+    if (!C3) {
+        fprintf(stderr, "Memory allocation failed for C3.\n");
+        exit(EXIT_FAILURE);
+    }
+    SparseMatrixBlockedCSR Ab = build_blocked_csr(&A, choose_panel_width(A.num_cols));
+
+    struct timespec start_blk, end_blk;
+    clock_gettime(CLOCK_MONOTONIC, &start_blk);
+    multiply_blocked(&Ab, B, C3, num_threads);
+    clock_gettime(CLOCK_MONOTONIC, &end_blk);
+    double blk_time = (end_blk.tv_sec - start_blk.tv_sec) + (end_blk.tv_nsec - start_blk.tv_nsec) / 1e9;
+
+    printf("Cache Blocked Parallel Result (C3), %d panel(s) of %d columns:\n", Ab.num_panels, Ab.panel_width);
+    for (int i = 0; i < A.num_rows; ++i) {
+        printf("%.4f ", C3[i]);
+    }
+    printf("\n\n");
+
     printf("Sequential execution time: %lf seconds\n", seq_time);
     printf("Parallel execution time:   %lf seconds\n", par_time);
+    printf("Blocked execution time:    %lf seconds\n", blk_time);
+
+    double flops = 2.0 * A.num_non_zeros;
+    roofline_report("Sequential SpMV", spmv_bytes_moved(&A), flops, "flop", seq_time);
+    roofline_report("Parallel SpMV", spmv_bytes_moved(&A), flops, "flop", par_time);
+    roofline_report("Blocked SpMV", blocked_bytes_moved(&Ab), flops, "flop", blk_time);
 
-    free(A.values);
-    free(A.col_indices);
-    free(A.row_pointers);
+    //transposed product A^T B, only possible when B has one entry per row of A
+    if (vector_size >= A.num_rows) {
+        double* D1 = (double*)calloc(A.num_cols + 1, sizeof(double));
+        double* D2 = (double*)calloc(A.num_cols + 1, sizeof(double));
+        if (!D1 || !D2) {
+            fprintf(stderr, "Memory allocation failed for D1 or D2.\n");
+            exit(EXIT_FAILURE);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start_seq);
+        multiply_transpose_sequential(&A, B, D1);
+        clock_gettime(CLOCK_MONOTONIC, &end_seq);
+        double tseq_time = (end_seq.tv_sec - start_seq.tv_sec) + (end_seq.tv_nsec - start_seq.tv_nsec) / 1e9;
+
+        clock_gettime(CLOCK_MONOTONIC, &start_par);
+        TransposeMode used = multiply_transpose(&A, B, D2, num_threads, TRANSPOSE_AUTO);
+        clock_gettime(CLOCK_MONOTONIC, &end_par);
+        double tpar_time = (end_par.tv_sec - start_par.tv_sec) + (end_par.tv_nsec - start_par.tv_nsec) / 1e9;
+
+        printf("\nSequential Transpose Result (D1):\n");
+        for (int i = 0; i < A.num_cols; ++i) {
+            printf("%.4f ", D1[i]);
+        }
+        printf("\n\n");
+        printf("Parallel Transpose Result (D2), %s:\n", transpose_mode_name(used));
+        for (int i = 0; i < A.num_cols; ++i) {
+            printf("%.4f ", D2[i]);
+        }
+        printf("\n\n");
+        printf("Sequential transpose execution time: %lf seconds\n", tseq_time);
+        printf("Parallel transpose execution time:   %lf seconds\n", tpar_time);
+        roofline_report("Sequential transpose SpMV", transpose_sequential_bytes_moved(&A), flops, "flop", tseq_time);
+        roofline_report("Parallel transpose SpMV", transpose_bytes_moved(&A, used, num_threads), flops, "flop", tpar_time);
+
+        free(D1);
+        free(D2);
+    }
+
+    free_matrix_csr(&A);
     free(B);
     free(C1);
     free(C2);
-    free(threads);
-    free(thread_data_array);
+    free(C3);
+    free_blocked_csr(&Ab);
+    free_row_slices(slices, num_threads);
+    perf_report(all_phases, 4);
 
     return 0;
 }
@@ -21,6 +21,13 @@ we have and have each thread compute the number of primes within the range assoc
 In both functions, the for directive is used to split up the range between the number of threads we have.
 In parallel only directive we use reduction to ensure the addition is done properly with less time taken
 In parallel + critical, the critical directive is used for serial thread addition (one by one, sort of like acquiring a lock on the variable)
+Both functions are instantiations of the segmented sieve in sieve_engine.hpp (bit storage, no wheel, OpenMP backend) that
+only differ in the aggregation policy. The --bench mode also runs byte storage, the 2/6/30/210 wheels, atomic
+aggregation and the pthread backend, each of them is one more type in the list below.
+The fused pass sieves once more and collects pi(x), twin primes, the largest gap, the sum of the primes and the count per
+last digit from the same segments, instead of one full sieve run per statistic.
+For scattered 64 bit numbers a sieve is the wrong tool, ./a.out --mr <count> [threads] tests count random numbers with
+the batched deterministic Miller-Rabin of primality_batch.hpp and reports the tests per second.
 
 Results:
 Enter the value of n: 32
@@ -47,133 +54,224 @@ although the number of additions is the same as critical, they are done parallel
 #include <chrono>
 #include <omp.h>
 #include <numeric>
+#include <cstring>
+#include <system_error>
+#include "bench_harness.h"
+#include "perf_counters.h"
+#include "roofline.h"
+#include "topology.h"
+#include "sieve_engine.hpp"
+#include "primality_batch.hpp"
 
 using namespace std;
 
-void countPrimesOpenMP_Reduction(unsigned long long limit) {
-    cout << "\nStarting OpenMP Parallel Prime Count (using Reduction)\n";
+PerfPhase phase_base_primes = PERF_PHASE_INIT("base primes");
+PerfPhase phase_segment_sieve = PERF_PHASE_INIT("segment sieve");
+PerfPhase phase_counting = PERF_PHASE_INIT("counting");
+PerfPhase* all_phases[] = {&phase_base_primes, &phase_segment_sieve, &phase_counting};
+sieve::Phases sieve_phases = {&phase_base_primes, &phase_segment_sieve, &phase_counting};
+
+//the two variants of the assignment, vector<bool> like storage over every number
+using ReductionSieve = sieve::SegmentedSieve<sieve::BitStorage, 1, sieve::Reduction, sieve::OpenMPBackend>;
+using CriticalSieve = sieve::SegmentedSieve<sieve::BitStorage, 1, sieve::Critical, sieve::OpenMPBackend>;
+
+//extra variants for --bench
+using AtomicSieve = sieve::SegmentedSieve<sieve::BitStorage, 1, sieve::Atomic, sieve::OpenMPBackend>;
+using ByteSieve = sieve::SegmentedSieve<sieve::ByteStorage, 1, sieve::Reduction, sieve::OpenMPBackend>;
+using OddSieve = sieve::SegmentedSieve<sieve::BitStorage, 2, sieve::Reduction, sieve::OpenMPBackend>;
+using Wheel6Sieve = sieve::SegmentedSieve<sieve::BitStorage, 6, sieve::Reduction, sieve::OpenMPBackend>;
+using Wheel30Sieve = sieve::SegmentedSieve<sieve::BitStorage, 30, sieve::Reduction, sieve::OpenMPBackend>;
+using Wheel210Sieve = sieve::SegmentedSieve<sieve::BitStorage, 210, sieve::Reduction, sieve::OpenMPBackend>;
+using ByteWheel30Sieve = sieve::SegmentedSieve<sieve::ByteStorage, 30, sieve::Reduction, sieve::OpenMPBackend>;
+using PthreadSieve = sieve::SegmentedSieve<sieve::BitStorage, 30, sieve::Reduction, sieve::PthreadBackend>;
+
+//one pass for pi(x), twin primes, the largest gap, the sum of the primes and the last digits
+using FusedSieve = Wheel30Sieve;
+using LastDigits = sieve::ResidueHistogram<10>;
+
+template <class Sieve>
+void countPrimes(const char* label, unsigned long long limit) {
+    cout << "\nStarting OpenMP Parallel Prime Count (using " << label << ")\n";
     auto start_time = chrono::high_resolution_clock::now();
 
-    unsigned long long limit_sqrt = static_cast<unsigned long long>(sqrt(limit));
-    unsigned long long total_prime_count = 0;
-
-    vector<bool> is_prime_base(limit_sqrt + 1, true);
-    is_prime_base[0] = is_prime_base[1] = false;
-    for (unsigned long long p = 2; p * p <= limit_sqrt; ++p) {
-        if (is_prime_base[p]) {
-            for (unsigned long long i = p * p; i <= limit_sqrt; i += p) {
-                is_prime_base[i] = false;
-            }
-        }
-    }
-
-    vector<unsigned long long> base_primes;
-    for (unsigned long long p = 2; p <= limit_sqrt; ++p) {
-        if (is_prime_base[p]) {
-            base_primes.push_back(p);
-        }
-    }
-    total_prime_count = base_primes.size();
-
-    const unsigned long long block_size = limit_sqrt;
-    
-    #pragma omp parallel for reduction(+:total_prime_count)
-    for (unsigned long long block_start = limit_sqrt + 1; block_start <= limit; block_start += block_size) {
-        unsigned long long block_end = min(block_start + block_size - 1, limit);
-        vector<bool> is_prime_block(block_end - block_start + 1, true);
-
-        for (unsigned long long p : base_primes) {
-            unsigned long long first_multiple = (block_start / p) * p;
-            if (first_multiple < block_start) {
-                first_multiple += p;
-            }
-
-            for (unsigned long long i = first_multiple; i <= block_end; i += p) {
-                is_prime_block[i - block_start] = false;
-            }
-        }
-
-        for (bool is_prime : is_prime_block) {
-            if (is_prime) {
-                total_prime_count++;
-            }
-        }
-    }
+    unsigned long long total_prime_count = Sieve::count(limit, omp_get_max_threads(), &sieve_phases);
 
     auto end_time = chrono::high_resolution_clock::now();
     chrono::duration<double> time_taken = end_time - start_time;
-    
-    cout << "OpenMP Reduction Execution Time: " << time_taken.count() << " seconds\n";
+
+    cout << "OpenMP " << label << " Execution Time: " << time_taken.count() << " seconds\n";
     cout << "Number of primes found: " << total_prime_count << "\n";
+    double ops = 0;
+    double bytes = Sieve::traffic(limit, &ops);
+    string kernel = string("OpenMP ") + label + " sieve";
+    roofline_report(kernel.c_str(), bytes, ops, "op", time_taken.count());
+}
+
+void countPrimesOpenMP_Reduction(unsigned long long limit) {
+    countPrimes<ReductionSieve>("Reduction", limit);
 }
 
 void countPrimesOpenMP_Critical(unsigned long long limit) {
-    cout << "\nStarting OpenMP Parallel Prime Count (using Critical)\n";
+    countPrimes<CriticalSieve>("Critical", limit);
+}
+
+void statsPrimesOpenMP_Fused(unsigned long long limit) {
+    cout << "\nStarting OpenMP Fused Statistics Pass\n";
     auto start_time = chrono::high_resolution_clock::now();
 
-    unsigned long long limit_sqrt = static_cast<unsigned long long>(sqrt(limit));
-    unsigned long long total_prime_count = 0;
+    auto [pi, twins, max_gap, prime_sum, last_digits] =
+        FusedSieve::collect<sieve::PrimeCount, sieve::TwinPrimes, sieve::MaxGap, sieve::PrimeSum, LastDigits>(
+            limit, omp_get_max_threads(), &sieve_phases);
 
-    vector<bool> is_prime_base(limit_sqrt + 1, true);
-    is_prime_base[0] = is_prime_base[1] = false;
-    for (unsigned long long p = 2; p * p <= limit_sqrt; ++p) {
-        if (is_prime_base[p]) {
-            for (unsigned long long i = p * p; i <= limit_sqrt; i += p) {
-                is_prime_base[i] = false;
-            }
-        }
-    }
+    auto end_time = chrono::high_resolution_clock::now();
+    chrono::duration<double> time_taken = end_time - start_time;
 
-    vector<unsigned long long> base_primes;
-    for (unsigned long long p = 2; p <= limit_sqrt; ++p) {
-        if (is_prime_base[p]) {
-            base_primes.push_back(p);
+    cout << "OpenMP Fused Execution Time: " << time_taken.count() << " seconds\n";
+    cout << "Number of primes found: " << pi.count << "\n";
+    cout << "Twin prime pairs: " << twins.pairs << "\n";
+    cout << "Largest gap: " << max_gap.gap << " (after " << max_gap.gap_start << ")\n";
+    cout << "Sum of primes: " << prime_sum.sum << "\n";
+    cout << "Primes by last digit:";
+    for (unsigned d = 0; d < LastDigits::modulus; ++d) {
+        if (last_digits.counts[d] > 0) {
+            cout << " " << d << ":" << last_digits.counts[d];
         }
     }
-    total_prime_count = base_primes.size();
-
-    const unsigned long long block_size = limit_sqrt;
-    #pragma omp parallel
-    {
-        unsigned long long local_count = 0;
-
-        #pragma omp for nowait
-        for (unsigned long long block_start = limit_sqrt + 1; block_start <= limit; block_start += block_size) {
-            unsigned long long block_end = min(block_start + block_size - 1, limit);
-            vector<bool> is_prime_block(block_end - block_start + 1, true);
-
-            for (unsigned long long p : base_primes) {
-                unsigned long long first_multiple = (block_start / p) * p;
-                if (first_multiple < block_start) {
-                    first_multiple += p;
-                }
-
-                for (unsigned long long i = first_multiple; i <= block_end; i += p) {
-                    is_prime_block[i - block_start] = false;
-                }
-            }
-            
-            for (bool is_prime : is_prime_block) {
-                if (is_prime) {
-                    local_count++;
-                }
-            }
-        }
+    cout << "\n";
+}
 
-        #pragma omp critical
-        {
-            total_prime_count += local_count;
-        }
+//count pseudo random 64 bit numbers (splitmix64, fixed seed so runs are comparable), odd so trial division by 2
+//does not decide half of them for free
+vector<uint64_t> randomOddNumbers(size_t count) {
+    vector<uint64_t> numbers(count);
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        numbers[i] = (z ^ (z >> 31)) | 1;
     }
+    return numbers;
+}
+
+//returns false if the batch disagrees with testing the numbers one at a time
+bool testPrimesMillerRabin(size_t count, int num_threads) {
+    cout << "\nStarting batched Miller-Rabin on " << count << " random odd 64 bit numbers\n";
+    vector<uint64_t> numbers = randomOddNumbers(count);
+    //poisoned, so an entry the batch forgets to write shows up in the check below
+    vector<uint8_t> is_prime(count, 0xAA);
+    primality::BatchPrimality tester;
 
+    auto start_time = chrono::high_resolution_clock::now();
+    tester.test(numbers.data(), is_prime.data(), count, num_threads);
     auto end_time = chrono::high_resolution_clock::now();
     chrono::duration<double> time_taken = end_time - start_time;
-    
-    cout << "OpenMP Critical Execution Time: " << time_taken.count() << " seconds\n";
-    cout << "Number of primes found: " << total_prime_count << "\n";
+
+    size_t primes_found = accumulate(is_prime.begin(), is_prime.end(), size_t(0));
+    double rate = time_taken.count() > 0 ? count / time_taken.count() : 0;
+    cout << "Miller-Rabin Execution Time: " << time_taken.count() << " seconds\n";
+    cout << "Number of primes found: " << primes_found << "\n";
+    cout << "Tests per second: " << rate / 1e6 << " million (" << rate / 1e6 / num_threads << " million per thread)\n";
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (is_prime[i] != (tester.is_prime(numbers[i]) ? 1 : 0)) {
+            mismatches++;
+        }
+    }
+    if (mismatches > 0) {
+        cout << "Check against one at a time testing FAILED: " << mismatches << " mismatches\n";
+        return false;
+    }
+    cout << "Check against one at a time testing: OK\n";
+    return true;
+}
+
+struct SieveBench {
+    unsigned long long limit;
+    int num_threads;
+};
+
+void* sieve_bench_setup(long long size, int num_threads) {
+    omp_set_num_threads(num_threads);
+    return new SieveBench{static_cast<unsigned long long>(size), num_threads};
+}
+
+template <class Sieve>
+double sieve_bench_run(void* ctx) {
+    SieveBench* bench = static_cast<SieveBench*>(ctx);
+    try {
+        return static_cast<double>(Sieve::count(bench->limit, bench->num_threads, &sieve_phases));
+    } catch (const system_error& e) {
+        cerr << "Failed to create thread: " << e.what() << "\n";
+        return NAN; //never equal to the checksum of a good run, so the harness flags it
+    }
+}
+
+double sieve_bench_run_fused(void* ctx) {
+    SieveBench* bench = static_cast<SieveBench*>(ctx);
+    auto [pi, twins, max_gap, prime_sum] =
+        FusedSieve::collect<sieve::PrimeCount, sieve::TwinPrimes, sieve::MaxGap, sieve::PrimeSum>(
+            bench->limit, bench->num_threads, &sieve_phases);
+    return static_cast<double>(pi.count + twins.pairs + max_gap.gap) + static_cast<double>(prime_sum.sum);
+}
+
+void sieve_bench_teardown(void* ctx) {
+    delete static_cast<SieveBench*>(ctx);
+}
+
+struct MillerRabinBench {
+    vector<uint64_t> numbers;
+    vector<uint8_t> is_prime;
+    int num_threads;
+    primality::BatchPrimality tester;
+};
+
+void* mr_bench_setup(long long size, int num_threads) {
+    MillerRabinBench* bench = new MillerRabinBench();
+    bench->numbers = randomOddNumbers(static_cast<size_t>(size));
+    bench->is_prime.resize(bench->numbers.size());
+    bench->num_threads = num_threads;
+    return bench;
+}
+
+double mr_bench_run(void* ctx) {
+    MillerRabinBench* bench = static_cast<MillerRabinBench*>(ctx);
+    bench->tester.test(bench->numbers.data(), bench->is_prime.data(), bench->numbers.size(), bench->num_threads);
+    return static_cast<double>(accumulate(bench->is_prime.begin(), bench->is_prime.end(), size_t(0)));
 }
 
-int main() {
+void mr_bench_teardown(void* ctx) {
+    delete static_cast<MillerRabinBench*>(ctx);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        const char* sizes = "2^20,2^24,2^28";
+        bench_register("openmp_reduction", sizes, sieve_bench_setup, sieve_bench_run<ReductionSieve>, sieve_bench_teardown);
+        bench_register("openmp_critical", sizes, sieve_bench_setup, sieve_bench_run<CriticalSieve>, sieve_bench_teardown);
+        bench_register("openmp_atomic", sizes, sieve_bench_setup, sieve_bench_run<AtomicSieve>, sieve_bench_teardown);
+        bench_register("openmp_byte", sizes, sieve_bench_setup, sieve_bench_run<ByteSieve>, sieve_bench_teardown);
+        bench_register("openmp_wheel2", sizes, sieve_bench_setup, sieve_bench_run<OddSieve>, sieve_bench_teardown);
+        bench_register("openmp_wheel6", sizes, sieve_bench_setup, sieve_bench_run<Wheel6Sieve>, sieve_bench_teardown);
+        bench_register("openmp_wheel30", sizes, sieve_bench_setup, sieve_bench_run<Wheel30Sieve>, sieve_bench_teardown);
+        bench_register("openmp_wheel210", sizes, sieve_bench_setup, sieve_bench_run<Wheel210Sieve>, sieve_bench_teardown);
+        bench_register("openmp_byte_wheel30", sizes, sieve_bench_setup, sieve_bench_run<ByteWheel30Sieve>, sieve_bench_teardown);
+        bench_register("pthread_wheel30", sizes, sieve_bench_setup, sieve_bench_run<PthreadSieve>, sieve_bench_teardown);
+        bench_register("openmp_fused_stats", sizes, sieve_bench_setup, sieve_bench_run_fused, sieve_bench_teardown);
+        bench_register("miller_rabin_batch", "2^16,2^20", mr_bench_setup, mr_bench_run, mr_bench_teardown);
+        int status = bench_main(argc, argv);
+        perf_report(all_phases, 3);
+        return status;
+    }
+    if (argc > 2 && strcmp(argv[1], "--mr") == 0) {
+        //./a.out --mr <count> [threads]
+        size_t count = strtoull(argv[2], nullptr, 10);
+        int threads = argc > 3 ? atoi(argv[3]) : omp_get_max_threads();
+        topo_print_placement();
+        return testPrimesMillerRabin(count, threads > 0 ? threads : 1) ? 0 : 1;
+    }
+
     int n, num_threads;
     cout << "Enter the value of n: ";
     cin >> n;
@@ -183,6 +281,7 @@ int main() {
 
     unsigned long long limit = 1ULL << n;
     cout << "Calculating primes up to 2^" << n << " = " << limit << ".\n\n";
+    topo_print_placement();
     
     omp_set_num_threads(num_threads);
     countPrimesOpenMP_Reduction(limit);
@@ -192,5 +291,10 @@ int main() {
     omp_set_num_threads(num_threads);
     countPrimesOpenMP_Critical(limit);
 
+    cout << "------------------------------------------\n";
+
+    statsPrimesOpenMP_Fused(limit);
+    perf_report(all_phases, 3);
+
     return 0;
 }
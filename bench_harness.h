@@ -0,0 +1,370 @@
+/*
+Shared benchmark harness for the PDC assignments (sum, pthread sieve, SpMV, OpenMP sieve).
+
+Every program registers its kernels with bench_register() and calls bench_main() when it is started with --bench.
+The harness sweeps the thread counts (smallest first) and input sizes, does warm-up runs and repeated timed trials,
+and reports median / min / p95 time together with the speedup and efficiency relative to the smallest thread count.
+The results are printed as a table and can be written as JSON or CSV for comparing configurations.
+
+Usage: <program> --bench [--threads 1,2,4,8] [--sizes 1024,2^20] [--warmup 2] [--trials 10] [--out results.json|results.csv]
+
+A kernel is three callbacks:
+    setup(size, num_threads)  allocates and initialises the input, returns a context (not timed)
+    run(ctx)                  the timed part, returns a checksum (e.g. the sum or the prime count)
+    teardown(ctx)             frees the context
+The checksum of every trial is compared against the first one of the same size (with a small relative tolerance,
+floating point kernels may add up in a different order with more threads), so a thread count that gives a
+different answer is flagged in the report.
+*/
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MAX_KERNELS 16
+#define BENCH_MAX_VALUES 32
+#define BENCH_MAX_RESULTS 1024
+
+typedef void *(*bench_setup_fn)(long long size, int num_threads);
+typedef double (*bench_run_fn)(void *ctx);
+typedef void (*bench_teardown_fn)(void *ctx);
+
+typedef struct {
+    const char *name;
+    const char *default_sizes; //used when --sizes is not given, same syntax as --sizes
+    bench_setup_fn setup;
+    bench_run_fn run;
+    bench_teardown_fn teardown;
+} BenchKernel;
+
+typedef struct {
+    int thread_counts[BENCH_MAX_VALUES];
+    int num_thread_counts;
+    long long sizes[BENCH_MAX_VALUES];
+    int num_sizes; //0 = use the default sizes of every kernel
+    int warmup;
+    int trials;
+    const char *out_path;
+} BenchConfig;
+
+typedef struct {
+    const char *kernel;
+    long long size;
+    int threads;
+    int trials;
+    double median_s;
+    double min_s;
+    double p95_s;
+    double speedup;
+    double efficiency;
+    double checksum;
+    int checksum_ok;
+} BenchResult;
+
+static BenchKernel bench_kernels[BENCH_MAX_KERNELS];
+static int bench_num_kernels = 0;
+
+static void bench_register(const char *name, const char *default_sizes, bench_setup_fn setup, bench_run_fn run, bench_teardown_fn teardown) {
+    if (bench_num_kernels >= BENCH_MAX_KERNELS) {
+        fprintf(stderr, "bench: too many kernels registered, ignoring %s\n", name);
+        return;
+    }
+    bench_kernels[bench_num_kernels].name = name;
+    bench_kernels[bench_num_kernels].default_sizes = default_sizes;
+    bench_kernels[bench_num_kernels].setup = setup;
+    bench_kernels[bench_num_kernels].run = run;
+    bench_kernels[bench_num_kernels].teardown = teardown;
+    bench_num_kernels++;
+}
+
+static double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//parses a comma separated list like "1024,2^20,65536" of positive values, returns the number of values read or -1
+//if an entry is not a positive integer, overflows, or is followed by anything but a comma
+static int bench_parse_list(const char *text, long long *values, int max_values) {
+    int count = 0;
+    const char *p = text;
+    while (*p) {
+        if (count == max_values) {
+            return -1;
+        }
+        char *end;
+        errno = 0;
+        long long value = strtoll(p, &end, 10);
+        if (end == p || errno == ERANGE) {
+            return -1;
+        }
+        if (*end == '^') {
+            const char *exponent_text = end + 1;
+            long long exponent = strtoll(exponent_text, &end, 10);
+            if (end == exponent_text || errno == ERANGE || exponent < 0 || value <= 0) {
+                return -1;
+            }
+            long long base = value;
+            value = 1;
+            for (long long i = 0; i < exponent && base > 1; i++) { //1^k is 1, no need to loop k times
+                if (value > LLONG_MAX / base) {
+                    return -1;
+                }
+                value *= base;
+            }
+        }
+        if (value <= 0 || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        values[count++] = value;
+        p = end;
+        if (*p == ',') {
+            p++;
+            if (*p == '\0') {
+                return -1;
+            }
+        }
+    }
+    return count;
+}
+
+//returns 0 on success, prints the usage and returns 1 on a bad argument
+static int bench_parse_args(int argc, char **argv, BenchConfig *cfg) {
+    long long values[BENCH_MAX_VALUES];
+
+    cfg->thread_counts[0] = 1;
+    cfg->thread_counts[1] = 2;
+    cfg->thread_counts[2] = 4;
+    cfg->thread_counts[3] = 8;
+    cfg->num_thread_counts = 4;
+    cfg->num_sizes = 0;
+    cfg->warmup = 2;
+    cfg->trials = 10;
+    cfg->out_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench") == 0) {
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "bench: missing value for %s\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--threads") == 0) {
+            int n = bench_parse_list(argv[++i], values, BENCH_MAX_VALUES);
+            for (int j = 0; j < n; j++) {
+                if (values[j] > INT_MAX) {
+                    n = -1;
+                    break;
+                }
+                cfg->thread_counts[j] = (int)values[j];
+            }
+            if (n < 0) {
+                fprintf(stderr, "bench: number of threads must be a positive integer.\n");
+                return 1;
+            }
+            cfg->num_thread_counts = n;
+        } else if (strcmp(argv[i], "--sizes") == 0) {
+            cfg->num_sizes = bench_parse_list(argv[++i], cfg->sizes, BENCH_MAX_VALUES);
+            if (cfg->num_sizes < 0) {
+                fprintf(stderr, "bench: sizes must be positive integers or powers like 2^20 that fit in 64 bits.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--warmup") == 0) {
+            cfg->warmup = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--trials") == 0) {
+            cfg->trials = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--out") == 0) {
+            cfg->out_path = argv[++i];
+        } else {
+            fprintf(stderr, "bench: unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (cfg->num_thread_counts <= 0 || cfg->trials <= 0 || cfg->warmup < 0) {
+        fprintf(stderr, "Usage: %s --bench [--threads 1,2,4,8] [--sizes 1024,2^20] [--warmup 2] [--trials 10] [--out results.json|results.csv]\n", argv[0]);
+        return 1;
+    }
+    for (int j = 0; j < cfg->num_thread_counts; j++) {
+        if (cfg->thread_counts[j] <= 0) {
+            fprintf(stderr, "bench: number of threads must be a positive integer.\n");
+            return 1;
+        }
+    }
+    //the sweep runs the smallest thread count first, it is the baseline of the speedup
+    for (int j = 1; j < cfg->num_thread_counts; j++) {
+        int threads = cfg->thread_counts[j];
+        int k = j;
+        for (; k > 0 && cfg->thread_counts[k - 1] > threads; k--) {
+            cfg->thread_counts[k] = cfg->thread_counts[k - 1];
+        }
+        cfg->thread_counts[k] = threads;
+    }
+    return 0;
+}
+
+static int bench_checksum_equal(double a, double b) {
+    double diff = a > b ? a - b : b - a;
+    double scale = a > 0 ? a : -a;
+    return diff <= 1e-9 * (scale > 1.0 ? scale : 1.0);
+}
+
+static int bench_compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+//value at quantile q of the sorted samples, nearest rank
+static double bench_quantile(const double *sorted, int n, double q) {
+    int rank = (int)(q * n + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+    return sorted[rank - 1];
+}
+
+static void bench_write_results(const char *path, const BenchResult *results, int num_results, const BenchConfig *cfg) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror("bench: error opening output file");
+        return;
+    }
+
+    size_t len = strlen(path);
+    int csv = len >= 4 && strcmp(path + len - 4, ".csv") == 0;
+    if (csv) {
+        fprintf(file, "kernel,size,threads,trials,median_s,min_s,p95_s,speedup,efficiency,checksum,checksum_ok\n");
+        for (int i = 0; i < num_results; i++) {
+            const BenchResult *r = &results[i];
+            fprintf(file, "%s,%lld,%d,%d,%.9f,%.9f,%.9f,%.4f,%.4f,%.17g,%d\n", r->kernel, r->size, r->threads, r->trials,
+                    r->median_s, r->min_s, r->p95_s, r->speedup, r->efficiency, r->checksum, r->checksum_ok);
+        }
+    } else {
+        fprintf(file, "{\n  \"warmup\": %d,\n  \"trials\": %d,\n  \"results\": [\n", cfg->warmup, cfg->trials);
+        for (int i = 0; i < num_results; i++) {
+            const BenchResult *r = &results[i];
+            fprintf(file, "    {\"kernel\": \"%s\", \"size\": %lld, \"threads\": %d, \"trials\": %d, \"median_s\": %.9f, "
+                          "\"min_s\": %.9f, \"p95_s\": %.9f, \"speedup\": %.4f, \"efficiency\": %.4f, \"checksum\": %.17g, "
+                          "\"checksum_ok\": %s}%s\n",
+                    r->kernel, r->size, r->threads, r->trials, r->median_s, r->min_s, r->p95_s, r->speedup, r->efficiency,
+                    r->checksum, r->checksum_ok ? "true" : "false", i + 1 < num_results ? "," : "");
+        }
+        fprintf(file, "  ]\n}\n");
+    }
+    fclose(file);
+    printf("\nResults written to %s\n", path);
+}
+
+static int bench_run_all(const BenchConfig *cfg) {
+    BenchResult *results = (BenchResult *)malloc(BENCH_MAX_RESULTS * sizeof(BenchResult));
+    double *samples = (double *)malloc(cfg->trials * sizeof(double));
+    if (!results || !samples) {
+        fprintf(stderr, "bench: memory allocation failed.\n");
+        return 1;
+    }
+    int num_results = 0;
+    int all_ok = 1;
+
+    printf("%-20s %14s %7s %12s %12s %12s %8s %8s\n", "kernel", "size", "threads", "median(s)", "min(s)", "p95(s)", "speedup", "eff");
+    for (int k = 0; k < bench_num_kernels; k++) {
+        const BenchKernel *kernel = &bench_kernels[k];
+        long long sizes[BENCH_MAX_VALUES];
+        int num_sizes = cfg->num_sizes;
+        if (num_sizes > 0) {
+            memcpy(sizes, cfg->sizes, num_sizes * sizeof(long long));
+        } else {
+            num_sizes = bench_parse_list(kernel->default_sizes, sizes, BENCH_MAX_VALUES);
+            if (num_sizes < 0) {
+                fprintf(stderr, "bench: bad default sizes \"%s\" for %s, skipping it\n", kernel->default_sizes, kernel->name);
+                all_ok = 0;
+                continue;
+            }
+        }
+
+        for (int s = 0; s < num_sizes; s++) {
+            double base_median = 0.0;
+            int base_threads = 0;
+            double expected = 0.0;
+
+            for (int t = 0; t < cfg->num_thread_counts && num_results < BENCH_MAX_RESULTS; t++) {
+                int threads = cfg->thread_counts[t];
+                void *ctx = kernel->setup(sizes[s], threads);
+                if (!ctx) {
+                    fprintf(stderr, "bench: setup of %s failed for size %lld\n", kernel->name, sizes[s]);
+                    continue;
+                }
+
+                double checksum = 0.0;
+                for (int w = 0; w < cfg->warmup; w++) {
+                    checksum = kernel->run(ctx);
+                }
+                int checksum_ok = 1;
+                for (int trial = 0; trial < cfg->trials; trial++) {
+                    double start = bench_now();
+                    double value = kernel->run(ctx);
+                    samples[trial] = bench_now() - start;
+                    if (trial == 0 && cfg->warmup == 0) {
+                        checksum = value;
+                    }
+                    if (!bench_checksum_equal(value, checksum)) {
+                        checksum_ok = 0;
+                    }
+                }
+                kernel->teardown(ctx);
+
+                if (base_threads == 0) {
+                    expected = checksum;
+                } else if (!bench_checksum_equal(checksum, expected)) {
+                    checksum_ok = 0;
+                }
+
+                qsort(samples, cfg->trials, sizeof(double), bench_compare_doubles);
+                BenchResult *r = &results[num_results++];
+                r->kernel = kernel->name;
+                r->size = sizes[s];
+                r->threads = threads;
+                r->trials = cfg->trials;
+                r->median_s = bench_quantile(samples, cfg->trials, 0.5);
+                r->min_s = samples[0];
+                r->p95_s = bench_quantile(samples, cfg->trials, 0.95);
+                r->checksum = checksum;
+                r->checksum_ok = checksum_ok;
+                all_ok = all_ok && checksum_ok;
+
+                //speedup is relative to the smallest thread count, which runs first
+                if (base_threads == 0) {
+                    base_median = r->median_s;
+                    base_threads = threads;
+                }
+                r->speedup = r->median_s > 0.0 ? base_median / r->median_s : 0.0;
+                r->efficiency = r->speedup * base_threads / threads;
+
+                printf("%-20s %14lld %7d %12.6f %12.6f %12.6f %8.2f %8.2f%s\n", r->kernel, r->size, r->threads, r->median_s,
+                       r->min_s, r->p95_s, r->speedup, r->efficiency, checksum_ok ? "" : "  CHECKSUM MISMATCH");
+            }
+        }
+    }
+
+    if (cfg->out_path) {
+        bench_write_results(cfg->out_path, results, num_results, cfg);
+    }
+    free(results);
+    free(samples);
+    return all_ok ? 0 : 1;
+}
+
+//entry point for the --bench mode of every program, the kernels must be registered before
+static int bench_main(int argc, char **argv) {
+    BenchConfig cfg;
+    if (bench_parse_args(argc, argv, &cfg) != 0) {
+        return 1;
+    }
+    return bench_run_all(&cfg);
+}
+
+#endif
@@ -0,0 +1,254 @@
+/*
+Per phase hardware performance counters for the PDC assignments, collected with perf_event_open.
+
+The write-ups explain the timings with guesses (threads waiting on each other, overhead of managing threads), this
+layer measures instead. Every named phase (base prime generation, segment sieving, counting, CSR build, SpMV, sum
+partition) is wrapped by the threads that execute it, each thread counts its own
+    cycles, instructions, LLC misses, branch misses and context switches
+and the per thread deltas are added into the phase. perf_report() then prints the IPC, misses per 1000 instructions (MPKI)
+and context switches of every phase.
+
+The counters are only opened when the environment variable PDC_PERF is set (PDC_PERF=1 ./a.out ...), so normal runs
+are unchanged. Cycles is opened as the group leader and the other events join its group, so the PMU schedules them
+together and IPC / MPKI divide counts from the same time window. When the PMU has to multiplex, every count is scaled
+by time_enabled / time_running and marked with ~ in the report, an interval in which an event never got on the PMU
+counts as missing rather than as 0. If an event cannot be opened (no PMU in a VM, perf_event_paranoid too high,
+missing permissions) it is reported as n/a and the program keeps running. Kernel counting is tried first and user
+only counting is used as the fallback, which is what perf_event_paranoid=2 allows.
+
+Usage inside a thread:
+    PerfThreadCounters pc;
+    perf_thread_open(&pc);
+    perf_thread_begin(&pc);  ...phase A...  perf_thread_end(&pc, &phase_a);
+    perf_thread_begin(&pc);  ...phase B...  perf_thread_end(&pc, &phase_b);
+    perf_thread_close(&pc);
+or perf_phase_begin(&pc) / perf_phase_end(&pc, &phase) when the thread only runs one phase.
+*/
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_CONTEXT_SWITCHES,
+    PERF_NUM_EVENTS
+} PerfEvent;
+
+typedef struct {
+    const char *name;
+    unsigned long long totals[PERF_NUM_EVENTS];
+    int missing[PERF_NUM_EVENTS]; //number of thread intervals where the event could not be counted
+    int scaled[PERF_NUM_EVENTS]; //number of thread intervals where the event was multiplexed and scaled
+    int intervals; //number of thread intervals added to the phase
+    pthread_mutex_t lock;
+} PerfPhase;
+
+#define PERF_PHASE_INIT(phase_name) { phase_name, {0, 0, 0, 0, 0}, {0, 0, 0, 0, 0}, {0, 0, 0, 0, 0}, 0, PTHREAD_MUTEX_INITIALIZER }
+
+//what read() returns with PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING
+typedef struct {
+    unsigned long long value;
+    unsigned long long time_enabled;
+    unsigned long long time_running;
+} PerfReading;
+
+typedef struct {
+    int fds[PERF_NUM_EVENTS];
+    PerfReading start[PERF_NUM_EVENTS];
+} PerfThreadCounters;
+
+static int perf_enabled_flag;
+
+static void perf_enabled_init() {
+    const char *env = getenv("PDC_PERF");
+    perf_enabled_flag = env != NULL && env[0] != '\0' && strcmp(env, "0") != 0;
+}
+
+//worker threads are often the first to ask, so the environment is read once under pthread_once
+static int perf_enabled() {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, perf_enabled_init);
+    return perf_enabled_flag;
+}
+
+//group_fd is the leader of the group to join, -1 to open a standalone event
+static int perf_open_event(uint32_t type, uint64_t config, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    //pid = 0, cpu = -1: count the calling thread on whatever cpu it runs
+    int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+    if (fd < 0) {
+        attr.exclude_kernel = 1;
+        fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+    }
+    return fd;
+}
+
+//joins the cycles group if there is one, and opens the event on its own if the group cannot take it
+static int perf_open_member(uint32_t type, uint64_t config, int leader) {
+    int fd = leader >= 0 ? perf_open_event(type, config, leader) : -1;
+    return fd >= 0 ? fd : perf_open_event(type, config, -1);
+}
+
+static void perf_thread_open(PerfThreadCounters *pc) {
+    memset(pc->start, 0, sizeof(pc->start));
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        pc->fds[e] = -1;
+    }
+    if (!perf_enabled()) {
+        return;
+    }
+    int leader = perf_open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+    pc->fds[PERF_CYCLES] = leader;
+    pc->fds[PERF_INSTRUCTIONS] = perf_open_member(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, leader);
+    pc->fds[PERF_LLC_MISSES] = perf_open_member(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, leader);
+    pc->fds[PERF_BRANCH_MISSES] = perf_open_member(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, leader);
+    pc->fds[PERF_CONTEXT_SWITCHES] = perf_open_member(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, leader);
+}
+
+static void perf_thread_close(PerfThreadCounters *pc) {
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        if (pc->fds[e] >= 0) {
+            close(pc->fds[e]);
+        }
+        pc->fds[e] = -1;
+    }
+}
+
+static PerfReading perf_read_fd(int fd) {
+    PerfReading r;
+    if (read(fd, &r, sizeof(r)) != (ssize_t)sizeof(r)) {
+        memset(&r, 0, sizeof(r));
+    }
+    return r;
+}
+
+static void perf_thread_begin(PerfThreadCounters *pc) {
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        if (pc->fds[e] >= 0) {
+            pc->start[e] = perf_read_fd(pc->fds[e]);
+        }
+    }
+}
+
+//adds what the thread counted since perf_thread_begin to the phase. an event that was only on the PMU for part of
+//the interval is scaled up to the whole interval, one that never got on it counts as missing like an unopened one
+static void perf_thread_end(PerfThreadCounters *pc, PerfPhase *phase) {
+    if (!perf_enabled()) {
+        return;
+    }
+    unsigned long long delta[PERF_NUM_EVENTS];
+    int scaled[PERF_NUM_EVENTS];
+    int missing[PERF_NUM_EVENTS];
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        delta[e] = 0;
+        scaled[e] = 0;
+        missing[e] = pc->fds[e] < 0;
+        if (missing[e]) {
+            continue;
+        }
+        PerfReading now = perf_read_fd(pc->fds[e]);
+        unsigned long long value = now.value - pc->start[e].value;
+        unsigned long long enabled = now.time_enabled - pc->start[e].time_enabled;
+        unsigned long long running = now.time_running - pc->start[e].time_running;
+        if (running == 0 && enabled > 0) {
+            missing[e] = 1;
+            continue;
+        }
+        if (running > 0 && running < enabled) {
+            value = (unsigned long long)((double)value * enabled / running);
+            scaled[e] = 1;
+        }
+        delta[e] = value;
+    }
+
+    pthread_mutex_lock(&phase->lock);
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        if (!missing[e]) {
+            phase->totals[e] += delta[e];
+            phase->scaled[e] += scaled[e];
+        } else {
+            phase->missing[e]++;
+        }
+    }
+    phase->intervals++;
+    pthread_mutex_unlock(&phase->lock);
+}
+
+static void perf_phase_begin(PerfThreadCounters *pc) {
+    perf_thread_open(pc);
+    perf_thread_begin(pc);
+}
+
+static void perf_phase_end(PerfThreadCounters *pc, PerfPhase *phase) {
+    perf_thread_end(pc, phase);
+    perf_thread_close(pc);
+}
+
+//prints the counters of the phases that were entered at least once, nothing if PDC_PERF is not set
+static void perf_report(PerfPhase **phases, int num_phases) {
+    if (!perf_enabled()) {
+        return;
+    }
+    printf("\nPerformance counters per phase (summed over threads):\n");
+    printf("%-16s %9s %14s %14s %6s %12s %8s %12s %8s %8s\n", "phase", "intervals", "cycles", "instructions", "IPC",
+           "LLC misses", "LLC MPKI", "br misses", "br MPKI", "ctx sw");
+
+    for (int i = 0; i < num_phases; i++) {
+        const PerfPhase *p = phases[i];
+        if (p->intervals == 0) {
+            continue;
+        }
+        char fields[PERF_NUM_EVENTS][32];
+        for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+            if (p->missing[e] == p->intervals) {
+                snprintf(fields[e], sizeof(fields[e]), "n/a");
+            } else {
+                snprintf(fields[e], sizeof(fields[e]), "%llu%s%s", p->totals[e], p->scaled[e] ? "~" : "",
+                         p->missing[e] ? "*" : "");
+            }
+        }
+
+        int have_cycles = p->missing[PERF_CYCLES] < p->intervals && p->totals[PERF_CYCLES] > 0;
+        int have_instructions = p->missing[PERF_INSTRUCTIONS] < p->intervals && p->totals[PERF_INSTRUCTIONS] > 0;
+        double kilo_instructions = p->totals[PERF_INSTRUCTIONS] / 1000.0;
+        char ipc[16], llc_mpki[16], br_mpki[16];
+        snprintf(ipc, sizeof(ipc), "n/a");
+        snprintf(llc_mpki, sizeof(llc_mpki), "n/a");
+        snprintf(br_mpki, sizeof(br_mpki), "n/a");
+        if (have_cycles && have_instructions) {
+            snprintf(ipc, sizeof(ipc), "%.2f", (double)p->totals[PERF_INSTRUCTIONS] / p->totals[PERF_CYCLES]);
+        }
+        if (have_instructions && p->missing[PERF_LLC_MISSES] < p->intervals) {
+            snprintf(llc_mpki, sizeof(llc_mpki), "%.2f", p->totals[PERF_LLC_MISSES] / kilo_instructions);
+        }
+        if (have_instructions && p->missing[PERF_BRANCH_MISSES] < p->intervals) {
+            snprintf(br_mpki, sizeof(br_mpki), "%.2f", p->totals[PERF_BRANCH_MISSES] / kilo_instructions);
+        }
+
+        printf("%-16s %9d %14s %14s %6s %12s %8s %12s %8s %8s\n", p->name, p->intervals, fields[PERF_CYCLES],
+               fields[PERF_INSTRUCTIONS], ipc, fields[PERF_LLC_MISSES], llc_mpki, fields[PERF_BRANCH_MISSES], br_mpki,
+               fields[PERF_CONTEXT_SWITCHES]);
+    }
+    printf("(n/a = counter not available or never scheduled, * = missing for some threads, ~ = scaled for multiplexing, "
+           "MPKI = misses per 1000 instructions)\n");
+}
+
+#endif
@@ -0,0 +1,269 @@
+/*
+Batched deterministic primality test for 64 bit numbers.
+
+The segmented sieve is the right tool for every prime in a range, but a few million scattered 64 bit numbers would
+need a sieve over the whole span between them. Here every number is tested on its own:
+
+    1. trial division by the base primes of the sieve (sieve::base_primes_up_to(trial_bound)). p | n is checked with
+       one multiplication by the inverse of p mod 2^64 instead of a division, this removes most composites and
+       decides every n below the square of the largest prime <= trial_bound (251^2 = 63001 for the default 256)
+    2. Miller-Rabin with the bases {2, 325, 9375, 28178, 450775, 9780504, 1795265022}, which has no strong
+       pseudoprime below 2^64, so the answer is exact. The modular multiplications use Montgomery form with
+       __uint128_t products. The Montgomery constants of a number (which need a 128 bit division) and the split
+       n - 1 = d * 2^s are computed once per number and reused for all the bases
+
+The numbers that survive step 1 are tested LANES at a time: the modular exponentiations of the lanes are done in
+lockstep, so the CPU overlaps the independent multiply chains instead of waiting on the latency of one. (x86 has no
+64x64->128 bit vector multiply, so the lanes are interleaved scalar chains rather than SIMD registers.) The batch is
+split in chunks over the OpenMP threads.
+*/
+#ifndef PRIMALITY_BATCH_HPP
+#define PRIMALITY_BATCH_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <omp.h>
+#include "sieve_engine.hpp"
+#include "topology.h"
+
+namespace primality {
+
+typedef unsigned __int128 u128;
+
+constexpr uint64_t mr_bases[] = {2, 325, 9375, 28178, 450775, 9780504, 1795265022};
+constexpr int LANES = 4;
+constexpr size_t CHUNK = 1024; //numbers per OpenMP work item
+
+//arithmetic mod an odd n in Montgomery form, x is stored as x * 2^64 mod n
+struct Montgomery {
+    uint64_t n;
+    uint64_t n_inv; //n * n_inv = 1 mod 2^64
+    uint64_t r2;    //2^128 mod n
+    uint64_t one;   //2^64 mod n
+
+    Montgomery() = default;
+    explicit Montgomery(uint64_t n_) : n(n_) {
+        n_inv = n; //correct to 3 bits for odd n, every newton step doubles that
+        for (int i = 0; i < 5; ++i) {
+            n_inv *= 2 - n * n_inv;
+        }
+        one = static_cast<uint64_t>(-n) % n;
+        r2 = static_cast<uint64_t>(static_cast<u128>(one) * one % n);
+    }
+
+    //t * 2^-64 mod n for t < n * 2^64
+    uint64_t reduce(u128 t) const {
+        uint64_t m = static_cast<uint64_t>(t) * n_inv;
+        uint64_t mn_hi = static_cast<uint64_t>((static_cast<u128>(m) * n) >> 64);
+        uint64_t t_hi = static_cast<uint64_t>(t >> 64);
+        uint64_t r = t_hi - mn_hi;
+        return t_hi < mn_hi ? r + n : r;
+    }
+    uint64_t mul(uint64_t a, uint64_t b) const {
+        return reduce(static_cast<u128>(a) * b);
+    }
+    //the Miller-Rabin bases are below 2^31, so the % is only needed for small n
+    uint64_t to_mont(uint64_t a) const {
+        return mul(a < n ? a : a % n, r2);
+    }
+};
+
+//a number that trial division could not decide, with what every Miller-Rabin base needs
+struct Candidate {
+    size_t index; //position in the batch
+    Montgomery mont;
+    uint64_t d; //n - 1 = d * 2^s with d odd
+    int s;
+
+    Candidate() = default;
+    Candidate(size_t index_, uint64_t n) : index(index_), mont(n) {
+        d = n - 1;
+        s = __builtin_ctzll(d);
+        d >>= s;
+    }
+};
+
+class BatchPrimality {
+public:
+    //trial divides by the primes up to trial_bound before Miller-Rabin
+    explicit BatchPrimality(uint64_t trial_bound = 256) {
+        for (unsigned long long p : sieve::base_primes_up_to(trial_bound)) {
+            TrialPrime t;
+            t.p = p;
+            t.inverse = p;
+            if (p != 2) {
+                for (int i = 0; i < 5; ++i) {
+                    t.inverse *= 2 - p * t.inverse;
+                }
+            }
+            t.max_quotient = UINT64_MAX / p;
+            trial_.push_back(t);
+        }
+        trial_square_ = trial_.empty() ? 0 : static_cast<u128>(trial_.back().p) * trial_.back().p;
+    }
+
+    //is_prime[i] = 1 if numbers[i] is prime, 0 otherwise
+    void test(const uint64_t *numbers, uint8_t *is_prime, size_t count, int num_threads) const {
+        long long num_chunks = static_cast<long long>((count + CHUNK - 1) / CHUNK);
+        #pragma omp parallel num_threads(num_threads)
+        {
+            topo_bind_omp_thread(omp_get_thread_num());
+            std::vector<Candidate> candidates;
+            candidates.reserve(CHUNK);
+
+            #pragma omp for schedule(dynamic, 4)
+            for (long long c = 0; c < num_chunks; ++c) {
+                size_t begin = static_cast<size_t>(c) * CHUNK;
+                size_t end = std::min(begin + CHUNK, count);
+                candidates.clear();
+                for (size_t i = begin; i < end; ++i) {
+                    int verdict = trial_division(numbers[i]);
+                    if (verdict < 0) {
+                        candidates.emplace_back(i, numbers[i]);
+                    } else {
+                        is_prime[i] = static_cast<uint8_t>(verdict);
+                    }
+                }
+
+                //one base at a time over the numbers still standing, so the lanes stay full after base 2 has
+                //removed nearly all the composites. a number that fails a base is written out as composite right
+                //away, the ones that pass are moved to the front for the next base
+                for (uint64_t base : mr_bases) {
+                    size_t kept = 0, k = 0;
+                    for (; k + LANES <= candidates.size(); k += LANES) {
+                        bool passed[LANES];
+                        witness_lanes(&candidates[k], base, passed);
+                        for (int l = 0; l < LANES; ++l) {
+                            if (passed[l]) {
+                                candidates[kept++] = candidates[k + l];
+                            } else {
+                                is_prime[candidates[k + l].index] = 0;
+                            }
+                        }
+                    }
+                    for (; k < candidates.size(); ++k) {
+                        if (witness(candidates[k], base)) {
+                            candidates[kept++] = candidates[k];
+                        } else {
+                            is_prime[candidates[k].index] = 0;
+                        }
+                    }
+                    candidates.resize(kept);
+                }
+                for (const Candidate &candidate : candidates) {
+                    is_prime[candidate.index] = 1;
+                }
+            }
+        }
+    }
+
+    bool is_prime(uint64_t n) const {
+        int verdict = trial_division(n);
+        return verdict < 0 ? miller_rabin(n) : verdict;
+    }
+
+private:
+    struct TrialPrime {
+        uint64_t p;
+        uint64_t inverse;      //p * inverse = 1 mod 2^64 (odd p only)
+        uint64_t max_quotient; //p | n exactly when n * inverse <= max_quotient
+    };
+    std::vector<TrialPrime> trial_;
+    u128 trial_square_;
+
+    //1 prime, 0 composite, -1 not decided
+    int trial_division(uint64_t n) const {
+        if (n < 2) {
+            return 0;
+        }
+        if ((n & 1) == 0) {
+            return n == 2;
+        }
+        for (const TrialPrime &t : trial_) {
+            if (t.p != 2 && n * t.inverse <= t.max_quotient) {
+                return n == t.p;
+            }
+        }
+        return n < trial_square_ ? 1 : -1;
+    }
+
+    //x = a^d in Montgomery form, decides the base once the squarings are done
+    static bool strong_probable_prime(const Montgomery &mont, uint64_t x, int s) {
+        uint64_t minus_one = mont.n - mont.one;
+        if (x == mont.one || x == minus_one) {
+            return true;
+        }
+        for (int r = 1; r < s; ++r) {
+            x = mont.mul(x, x);
+            if (x == minus_one) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //the candidate passes the strong test to this base
+    static bool witness(const Candidate &c, uint64_t base) {
+        const Montgomery &mont = c.mont;
+        uint64_t a = mont.to_mont(base);
+        if (a == 0) {
+            return true; //base is a multiple of n, says nothing
+        }
+        uint64_t x = mont.one;
+        for (int bit = 63 - __builtin_clzll(c.d); bit >= 0; --bit) {
+            x = mont.mul(x, x);
+            if ((c.d >> bit) & 1) {
+                x = mont.mul(x, a);
+            }
+        }
+        return strong_probable_prime(mont, x, c.s);
+    }
+
+    static bool miller_rabin(uint64_t n) {
+        Candidate c(0, n);
+        for (uint64_t base : mr_bases) {
+            if (!witness(c, base)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //witness() for LANES candidates at once. the exponentiations run in lockstep over the longest exponent, 2 bits
+    //per step with a table of a^0..a^3, so there is no data dependent branch and only one multiply per 2 bits besides
+    //the squarings. a lane with a shorter exponent squares its starting 1 until its own bits begin
+    static void witness_lanes(const Candidate *c, uint64_t base, bool *passed) {
+        uint64_t powers[LANES][4];
+        int top_bit = 0;
+        for (int l = 0; l < LANES; ++l) {
+            const Montgomery &mont = c[l].mont;
+            top_bit = std::max(top_bit, 63 - __builtin_clzll(c[l].d));
+            uint64_t a = mont.to_mont(base);
+            powers[l][0] = mont.one;
+            powers[l][1] = a;
+            powers[l][2] = mont.mul(a, a);
+            powers[l][3] = mont.mul(powers[l][2], a);
+        }
+
+        uint64_t x[LANES];
+        for (int l = 0; l < LANES; ++l) {
+            x[l] = c[l].mont.one;
+        }
+        for (int bit = top_bit & ~1; bit >= 0; bit -= 2) {
+            for (int l = 0; l < LANES; ++l) {
+                const Montgomery &mont = c[l].mont;
+                uint64_t y = mont.mul(x[l], x[l]);
+                y = mont.mul(y, y);
+                x[l] = mont.mul(y, powers[l][(c[l].d >> bit) & 3]);
+            }
+        }
+        for (int l = 0; l < LANES; ++l) {
+            passed[l] = powers[l][1] == 0 || strong_probable_prime(c[l].mont, x[l], c[l].s);
+        }
+    }
+};
+
+} // namespace primality
+
+#endif
@@ -0,0 +1,305 @@
+/*
+Achieved bandwidth and roofline reporting for the SpMV and sieve kernels.
+
+Every kernel computes the bytes it moves from a simple traffic model (every array is streamed once, a strided store
+moves at most one cache line) and the operations it does (2 flops per non zero for SpMV, one operation per marked
+multiple or checked entry for the sieves). roofline_report() turns that into
+    achieved GB/s, arithmetic intensity (operations per byte), achieved operations per second
+    and the percent of the roofline min(peak_ops, peak_bw * intensity)
+A kernel left of the ridge point (peak_ops / peak_bw) is bounded by memory, one right of it by the core; the report
+says which roof applies. SpMV does well under one flop per byte and is memory bound. A sieve whose segments stay in
+cache only sends the segment initialisation and counting to memory, so its intensity is high and the compute roof is
+the one it is measured against.
+
+The peak bandwidth is measured once per run with a STREAM style triad (a[i] = b[i] + s * c[i]) over arrays much larger
+than the LLC, using one pthread per online cpu and counting 24 bytes per element like STREAM does. Setting the
+environment variable PDC_PEAK_BW (in GB/s) skips the probe, e.g. PDC_PEAK_BW=25.6 to use the datasheet number.
+The compute peak is a scalar probe: one pthread per online cpu runs independent multiply-add chains in registers
+(2 operations per step). It is a scalar roof, vector units can go higher. PDC_PEAK_OPS (in G operations/s) skips it.
+*/
+#ifndef ROOFLINE_H
+#define ROOFLINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ROOFLINE_CACHE_LINE 64
+#define ROOFLINE_CACHED_SEGMENT_BYTES (1024 * 1024) //segments up to this size are assumed to stay in the L2 while marking
+#define ROOFLINE_STREAM_ELEMENTS (16 * 1024 * 1024) //per array, 3 arrays of 128 MB
+#define ROOFLINE_STREAM_REPEATS 5
+#define ROOFLINE_COMPUTE_STEPS (20 * 1000 * 1000) //per thread, each step is 8 multiply-adds
+
+typedef struct {
+    int thread_id;
+    int num_threads;
+    long long n;
+    double *a;
+    double *b;
+    double *c;
+    pthread_barrier_t *barrier;
+    pthread_mutex_t *start_lock;
+    pthread_cond_t *start_cond;
+    int *start; //0 while the threads are created, 1 to run, -1 if one could not be created
+    double *best_time; //written by thread 0 only
+} RooflineStreamData;
+
+static inline double roofline_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void *roofline_stream_worker(void *arg) {
+    RooflineStreamData *data = (RooflineStreamData *)arg;
+    long long chunk = data->n / data->num_threads;
+    long long start = data->thread_id * chunk;
+    long long end = data->thread_id == data->num_threads - 1 ? data->n : start + chunk;
+
+    //nobody reaches the barrier before all the threads exist, a missing one would leave the others waiting forever
+    pthread_mutex_lock(data->start_lock);
+    while (*data->start == 0) {
+        pthread_cond_wait(data->start_cond, data->start_lock);
+    }
+    int run = *data->start > 0;
+    pthread_mutex_unlock(data->start_lock);
+    if (!run) {
+        return NULL;
+    }
+
+    //first touch by the thread that later streams the chunk
+    for (long long i = start; i < end; i++) {
+        data->a[i] = 0.0;
+        data->b[i] = 1.0;
+        data->c[i] = 2.0;
+    }
+
+    const double scalar = 3.0;
+    for (int rep = 0; rep < ROOFLINE_STREAM_REPEATS; rep++) {
+        pthread_barrier_wait(data->barrier);
+        double t0 = roofline_now();
+        for (long long i = start; i < end; i++) {
+            data->a[i] = data->b[i] + scalar * data->c[i];
+        }
+        pthread_barrier_wait(data->barrier);
+        if (data->thread_id == 0) {
+            double t = roofline_now() - t0;
+            if (*data->best_time == 0.0 || t < *data->best_time) {
+                *data->best_time = t;
+            }
+        }
+    }
+    return NULL;
+}
+
+//peak memory bandwidth of the host in bytes per second, measured on the first call and cached.
+//returns 0 if the probe could not run
+static inline double roofline_peak_bandwidth() {
+    static double peak = -1.0;
+    if (peak >= 0.0) {
+        return peak;
+    }
+
+    const char *env = getenv("PDC_PEAK_BW");
+    if (env != NULL && atof(env) > 0.0) {
+        peak = atof(env) * 1e9;
+        return peak;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_threads = cpus > 0 ? (int)cpus : 1;
+    long long n = ROOFLINE_STREAM_ELEMENTS;
+    double *a = (double *)malloc(n * sizeof(double));
+    double *b = (double *)malloc(n * sizeof(double));
+    double *c = (double *)malloc(n * sizeof(double));
+    pthread_t *threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+    RooflineStreamData *thread_data = (RooflineStreamData *)malloc(num_threads * sizeof(RooflineStreamData));
+    if (!a || !b || !c || !threads || !thread_data) {
+        fprintf(stderr, "Roofline: memory allocation failed for the bandwidth probe.\n");
+        free(a);
+        free(b);
+        free(c);
+        free(threads);
+        free(thread_data);
+        peak = 0.0;
+        return peak;
+    }
+
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, num_threads);
+    pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+    int start = 0;
+    int started = 0;
+    double best_time = 0.0;
+    for (int i = 0; i < num_threads; i++) {
+        thread_data[i].thread_id = i;
+        thread_data[i].num_threads = num_threads;
+        thread_data[i].n = n;
+        thread_data[i].a = a;
+        thread_data[i].b = b;
+        thread_data[i].c = c;
+        thread_data[i].barrier = &barrier;
+        thread_data[i].start_lock = &start_lock;
+        thread_data[i].start_cond = &start_cond;
+        thread_data[i].start = &start;
+        thread_data[i].best_time = &best_time;
+        if (pthread_create(&threads[i], NULL, roofline_stream_worker, &thread_data[i]) != 0) {
+            fprintf(stderr, "Roofline: could not create the threads for the bandwidth probe.\n");
+            break;
+        }
+        started++;
+    }
+    pthread_mutex_lock(&start_lock);
+    start = started == num_threads ? 1 : -1;
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&start_lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    peak = start > 0 && best_time > 0.0 ? 3.0 * sizeof(double) * n / best_time : 0.0;
+    free(a);
+    free(b);
+    free(c);
+    free(threads);
+    free(thread_data);
+    return peak;
+}
+
+typedef struct {
+    double seconds;
+    double sink; //keeps the chains alive
+} RooflineComputeData;
+
+//8 independent multiply-add chains, enough to cover the latency of the FP units. without -ffast-math the compiler
+//may not reassociate them, so every step really does 16 operations
+static inline void *roofline_compute_worker(void *arg) {
+    RooflineComputeData *data = (RooflineComputeData *)arg;
+    double a0 = 1.0, a1 = 1.1, a2 = 1.2, a3 = 1.3, a4 = 1.4, a5 = 1.5, a6 = 1.6, a7 = 1.7;
+    const double m = 0.999999, c = 1e-6;
+    double t0 = roofline_now();
+    for (long long i = 0; i < ROOFLINE_COMPUTE_STEPS; i++) {
+        a0 = a0 * m + c;
+        a1 = a1 * m + c;
+        a2 = a2 * m + c;
+        a3 = a3 * m + c;
+        a4 = a4 * m + c;
+        a5 = a5 * m + c;
+        a6 = a6 * m + c;
+        a7 = a7 * m + c;
+    }
+    data->seconds = roofline_now() - t0;
+    data->sink = a0 + a1 + a2 + a3 + a4 + a5 + a6 + a7;
+    return NULL;
+}
+
+//peak scalar operations per second of the host, measured on the first call and cached. returns 0 if unknown
+static inline double roofline_peak_ops() {
+    static double peak = -1.0;
+    if (peak >= 0.0) {
+        return peak;
+    }
+
+    const char *env = getenv("PDC_PEAK_OPS");
+    if (env != NULL && atof(env) > 0.0) {
+        peak = atof(env) * 1e9;
+        return peak;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_threads = cpus > 0 ? (int)cpus : 1;
+    pthread_t *threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+    RooflineComputeData *thread_data = (RooflineComputeData *)calloc(num_threads, sizeof(RooflineComputeData));
+    if (!threads || !thread_data) {
+        free(threads);
+        free(thread_data);
+        peak = 0.0;
+        return peak;
+    }
+    int started = 0;
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, roofline_compute_worker, &thread_data[i]) != 0) {
+            fprintf(stderr, "Roofline: could not create the threads for the compute probe.\n");
+            break;
+        }
+        started++;
+    }
+    double slowest = 0.0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        if (thread_data[i].seconds > slowest) {
+            slowest = thread_data[i].seconds;
+        }
+    }
+    //fewer threads than cpus would understate the peak, so it is unknown instead
+    peak = started == num_threads && slowest > 0.0 ? 16.0 * ROOFLINE_COMPUTE_STEPS * num_threads / slowest : 0.0;
+    free(threads);
+    free(thread_data);
+    return peak;
+}
+
+//bytes moved by stores to `marks` entries that are stride_bytes apart: a stride shorter than a cache line shares
+//the lines between the stores, a longer one moves a whole line per store
+static inline double roofline_strided_bytes(double marks, double stride_bytes) {
+    return marks * (stride_bytes < ROOFLINE_CACHE_LINE ? stride_bytes : ROOFLINE_CACHE_LINE);
+}
+
+//traffic of a segmented sieve over [lo, hi] that stores bytes_per_number bytes per number (1 for char arrays,
+//1/8 for vector<bool>) in segments of segment_bytes bytes: the segments are initialised, the multiples of every
+//base prime are struck out and the segments are read once more to count. the marking stores only reach memory
+//when a segment is larger than ROOFLINE_CACHED_SEGMENT_BYTES. start_at_square is set when marking starts at p * p
+//instead of at the first multiple >= lo. ops gets one operation per marked multiple and per counted entry
+static inline double roofline_sieve_bytes(unsigned long long lo, unsigned long long hi, const unsigned long long *primes,
+                                   int num_primes, double bytes_per_number, double segment_bytes, int start_at_square,
+                                   double *ops) {
+    double numbers = hi >= lo ? (double)(hi - lo + 1) : 0.0;
+    double bytes = 2.0 * numbers * bytes_per_number;
+    int marks_in_cache = segment_bytes <= ROOFLINE_CACHED_SEGMENT_BYTES;
+    double total_marks = 0.0;
+    for (int i = 0; i < num_primes && hi >= lo; i++) {
+        unsigned long long p = primes[i];
+        unsigned long long first = lo;
+        if (start_at_square && p * p > first) {
+            first = p * p;
+        }
+        if (first > hi) {
+            continue;
+        }
+        double marks = (double)(hi / p - (first - 1) / p);
+        total_marks += marks;
+        if (!marks_in_cache) {
+            bytes += roofline_strided_bytes(marks, p * bytes_per_number);
+        }
+    }
+    if (ops) {
+        *ops = total_marks + numbers;
+    }
+    return bytes;
+}
+
+static inline void roofline_report(const char *kernel, double bytes, double ops, const char *ops_unit, double seconds) {
+    double peak_bw = roofline_peak_bandwidth();
+    double peak_ops = roofline_peak_ops();
+    double achieved_bw = seconds > 0.0 ? bytes / seconds : 0.0;
+    double achieved_ops = seconds > 0.0 ? ops / seconds : 0.0;
+    double intensity = bytes > 0.0 ? ops / bytes : 0.0;
+
+    printf("%s: %.3f MB moved, %.2f GB/s, arithmetic intensity %.3f %s/byte, %.3f G%s/s", kernel, bytes / 1e6,
+           achieved_bw / 1e9, intensity, ops_unit, achieved_ops / 1e9, ops_unit);
+    if (peak_bw <= 0.0 || peak_ops <= 0.0) {
+        printf(", peak %s unknown\n", peak_bw <= 0.0 ? "bandwidth" : "compute");
+        return;
+    }
+    double memory_roof = peak_bw * intensity;
+    int memory_bound = memory_roof < peak_ops;
+    double roof = memory_bound ? memory_roof : peak_ops;
+    printf(", %.1f%% of roofline (%s bound, roof %.3f G%s/s; peak %.2f GB/s, %.2f G%s/s, ridge %.3f %s/byte)\n",
+           roof > 0.0 ? 100.0 * achieved_ops / roof : 0.0, memory_bound ? "memory" : "compute", roof / 1e9, ops_unit,
+           peak_bw / 1e9, peak_ops / 1e9, ops_unit, peak_ops / peak_bw, ops_unit);
+}
+
+#endif
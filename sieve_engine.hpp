@@ -0,0 +1,730 @@
+/*
+Compile time specialized segmented sieve of eratosthenes.
+
+countPrimesOpenMP_Reduction, countPrimesOpenMP_Critical and the pthread sieve of assignment 2 were three copies of
+the same segmented sieve that only differed in how the per thread counts are added up and how the threads are
+started. Here the algorithm is written once and every choice is a template parameter:
+
+    SegmentedSieve<Storage, WheelModulus, Aggregation, Backend>
+
+    Storage       ByteStorage  one byte per stored number (like the char arrays of assignment 2)
+                  BitStorage   one bit per stored number, counted with popcount (like vector<bool>)
+    WheelModulus  1 (every number), 2 (odd numbers), 6, 30 or 210: only numbers coprime to the modulus are stored,
+                  the multiples of a prime are visited with the constexpr gap table of the wheel
+    Aggregation   Reduction    per thread partial counts combined at the end (omp reduction / sum after join)
+                  Critical     per thread partial counts added to the total under a lock (omp critical / mutex)
+                  Atomic       every segment adds its count to the total with an atomic add
+    Backend       OpenMPBackend    one omp parallel region, segments split with omp for
+                  PthreadBackend   num_threads pthreads, each one gets a contiguous run of segments
+
+The wheel tables (residues, gaps, residue -> slot index) are built with constexpr functions, and the policies are
+picked with if constexpr, so every combination compiles to its own inner loop without runtime branches on the
+configuration. New variants can be benchmarked by adding one line with a new type instead of copying a function.
+
+count() only counts the primes. collect<Statistics...>() runs the same sieve once and hands every prime of a segment
+to all the requested statistics (PrimeCount, TwinPrimes, MaxGap, PrimeSum, ResidueHistogram<Q>) while the segment is
+still in cache. Each segment leaves a small summary (its first and last prime and what it found inside), the summaries
+are merged in segment order so twin pairs and gaps across segment and thread edges are counted exactly once.
+
+Threads are pinned with topology.h when PDC_PLACEMENT is set and the phases are counted with perf_counters.h when
+PDC_PERF is set, like in the rest of the assignments.
+*/
+#ifndef SIEVE_ENGINE_HPP
+#define SIEVE_ENGINE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <omp.h>
+#include "perf_counters.h"
+#include "roofline.h"
+#include "topology.h"
+
+namespace sieve {
+
+// ---------- wheel tables ----------
+
+constexpr unsigned gcd(unsigned a, unsigned b) {
+    while (b != 0) {
+        unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+constexpr unsigned totient(unsigned m) {
+    unsigned count = 0;
+    for (unsigned r = 0; r < m; ++r) {
+        if (gcd(r, m) == 1 || m == 1) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+template <unsigned M>
+struct Wheel {
+    static_assert(M == 1 || M == 2 || M == 6 || M == 30 || M == 210, "wheel modulus must be a primorial");
+
+    static constexpr unsigned modulus = M;
+    static constexpr unsigned count = totient(M); //stored numbers per turn of the wheel
+
+    //residues coprime to M in increasing order
+    static constexpr std::array<unsigned, count> make_residues() {
+        std::array<unsigned, count> residues{};
+        unsigned k = 0;
+        for (unsigned r = 0; r < M; ++r) {
+            if (gcd(r, M) == 1 || M == 1) {
+                residues[k++] = r;
+            }
+        }
+        return residues;
+    }
+
+    //distance from residue i to the next one, the last one wraps around to the next turn
+    static constexpr std::array<unsigned, count> make_gaps() {
+        std::array<unsigned, count> r = make_residues();
+        std::array<unsigned, count> gaps{};
+        for (unsigned i = 0; i + 1 < count; ++i) {
+            gaps[i] = r[i + 1] - r[i];
+        }
+        gaps[count - 1] = M + r[0] - r[count - 1];
+        return gaps;
+    }
+
+    //ceil_index[x] = number of residues smaller than x, for x in [0, M]
+    static constexpr std::array<unsigned, M + 1> make_ceil_index() {
+        std::array<unsigned, count> r = make_residues();
+        std::array<unsigned, M + 1> ceil_index{};
+        unsigned k = 0;
+        for (unsigned x = 0; x <= M; ++x) {
+            while (k < count && r[k] < x) {
+                ++k;
+            }
+            ceil_index[x] = k;
+        }
+        return ceil_index;
+    }
+
+    static constexpr std::array<unsigned, count> residues = make_residues();
+    static constexpr std::array<unsigned, count> gaps = make_gaps();
+    static constexpr std::array<unsigned, M + 1> ceil_index = make_ceil_index();
+
+    //number of stored slots below x, i.e. the first slot of a number >= x, counted from a multiple of M.
+    //for x coprime to M this is the slot of x itself
+    static constexpr unsigned long long ceil_slot(unsigned long long x) {
+        return (x / M) * count + ceil_index[x % M];
+    }
+
+    //smallest k' >= k coprime to M, and the index of its residue
+    static constexpr unsigned long long next_coprime(unsigned long long k, unsigned &residue_index) {
+        unsigned i = ceil_index[k % M];
+        unsigned long long turn = k / M;
+        if (i == count) {
+            i = 0;
+            ++turn;
+        }
+        residue_index = i;
+        return turn * M + residues[i];
+    }
+
+    static constexpr bool divides_modulus(unsigned long long p) {
+        return p <= M && M % p == 0;
+    }
+};
+
+// ---------- storage policies ----------
+
+struct ByteStorage {
+    static constexpr double bytes_per_slot = 1.0;
+    std::vector<uint8_t> flags;
+
+    void reset(unsigned long long slots) {
+        flags.assign(slots, 1);
+    }
+    void clear(unsigned long long slot) {
+        flags[slot] = 0;
+    }
+    bool test(unsigned long long slot) const {
+        return flags[slot] != 0;
+    }
+    unsigned long long count(unsigned long long first, unsigned long long last) const {
+        unsigned long long total = 0;
+        for (unsigned long long i = first; i < last; ++i) {
+            total += flags[i];
+        }
+        return total;
+    }
+    //calls f(slot) for every set slot in [first, last) in increasing order
+    template <class F>
+    void for_each_set(unsigned long long first, unsigned long long last, F f) const {
+        for (unsigned long long i = first; i < last; ++i) {
+            if (flags[i]) {
+                f(i);
+            }
+        }
+    }
+};
+
+struct BitStorage {
+    static constexpr double bytes_per_slot = 1.0 / 8;
+    std::vector<uint64_t> words;
+
+    void reset(unsigned long long slots) {
+        words.assign((slots + 63) / 64, ~0ULL);
+    }
+    void clear(unsigned long long slot) {
+        words[slot >> 6] &= ~(1ULL << (slot & 63));
+    }
+    bool test(unsigned long long slot) const {
+        return (words[slot >> 6] >> (slot & 63)) & 1;
+    }
+    //set bits in [first, last)
+    unsigned long long count(unsigned long long first, unsigned long long last) const {
+        if (first >= last) {
+            return 0;
+        }
+        unsigned long long w0 = first >> 6, w1 = (last - 1) >> 6;
+        uint64_t head = ~0ULL << (first & 63);
+        uint64_t tail = ~0ULL >> (63 - ((last - 1) & 63));
+        if (w0 == w1) {
+            return __builtin_popcountll(words[w0] & head & tail);
+        }
+        unsigned long long total = __builtin_popcountll(words[w0] & head) + __builtin_popcountll(words[w1] & tail);
+        for (unsigned long long w = w0 + 1; w < w1; ++w) {
+            total += __builtin_popcountll(words[w]);
+        }
+        return total;
+    }
+    template <class F>
+    void for_each_set(unsigned long long first, unsigned long long last, F f) const {
+        if (first >= last) {
+            return;
+        }
+        unsigned long long w0 = first >> 6, w1 = (last - 1) >> 6;
+        for (unsigned long long w = w0; w <= w1; ++w) {
+            uint64_t bits = words[w];
+            if (w == w0) {
+                bits &= ~0ULL << (first & 63);
+            }
+            if (w == w1) {
+                bits &= ~0ULL >> (63 - ((last - 1) & 63));
+            }
+            while (bits) {
+                f((w << 6) + __builtin_ctzll(bits));
+                bits &= bits - 1;
+            }
+        }
+    }
+};
+
+// ---------- aggregation policies ----------
+
+enum class AggregationKind { Reduction, Critical, Atomic };
+
+struct Reduction {
+    static constexpr AggregationKind kind = AggregationKind::Reduction;
+    static constexpr const char *name = "reduction";
+};
+struct Critical {
+    static constexpr AggregationKind kind = AggregationKind::Critical;
+    static constexpr const char *name = "critical";
+};
+struct Atomic {
+    static constexpr AggregationKind kind = AggregationKind::Atomic;
+    static constexpr const char *name = "atomic";
+};
+
+// ---------- statistics ----------
+
+//statistics for SegmentedSieve::collect. every statistic has a Segment summary that sees the primes of one segment
+//in increasing order while the segment is still in cache, and merge() that is called with the summaries of all
+//segments in order, so pairs and gaps across a segment edge are found from the last prime of the previous segment
+
+struct PrimeCount {
+    struct Segment {
+        unsigned long long count = 0;
+        void add(unsigned long long) { ++count; }
+    };
+    unsigned long long count = 0;
+    void merge(const Segment &seg) { count += seg.count; }
+};
+
+struct TwinPrimes {
+    struct Segment {
+        unsigned long long first = 0, last = 0, pairs = 0;
+        void add(unsigned long long p) {
+            if (last != 0 && p - last == 2) {
+                ++pairs;
+            }
+            if (first == 0) {
+                first = p;
+            }
+            last = p;
+        }
+    };
+    unsigned long long pairs = 0, last = 0;
+    void merge(const Segment &seg) {
+        if (seg.first == 0) {
+            return;
+        }
+        if (last != 0 && seg.first - last == 2) {
+            ++pairs;
+        }
+        pairs += seg.pairs;
+        last = seg.last;
+    }
+};
+
+//largest difference between consecutive primes, the first one if there are several
+struct MaxGap {
+    struct Segment {
+        unsigned long long first = 0, last = 0, gap = 0, gap_start = 0;
+        void add(unsigned long long p) {
+            if (last != 0 && p - last > gap) {
+                gap = p - last;
+                gap_start = last;
+            }
+            if (first == 0) {
+                first = p;
+            }
+            last = p;
+        }
+    };
+    unsigned long long gap = 0, gap_start = 0, last = 0;
+    void merge(const Segment &seg) {
+        if (seg.first == 0) {
+            return;
+        }
+        if (last != 0 && seg.first - last > gap) {
+            gap = seg.first - last;
+            gap_start = last;
+        }
+        if (seg.gap > gap) {
+            gap = seg.gap;
+            gap_start = seg.gap_start;
+        }
+        last = seg.last;
+    }
+};
+
+//the sum of the primes below 2^32 is about 4.25e17, well inside 64 bits
+struct PrimeSum {
+    struct Segment {
+        unsigned long long sum = 0;
+        void add(unsigned long long p) { sum += p; }
+    };
+    unsigned long long sum = 0;
+    void merge(const Segment &seg) { sum += seg.sum; }
+};
+
+template <unsigned Q>
+struct ResidueHistogram {
+    static constexpr unsigned modulus = Q;
+    struct Segment {
+        std::array<unsigned long long, Q> counts{};
+        void add(unsigned long long p) { ++counts[p % Q]; }
+    };
+    std::array<unsigned long long, Q> counts{};
+    void merge(const Segment &seg) {
+        for (unsigned r = 0; r < Q; ++r) {
+            counts[r] += seg.counts[r];
+        }
+    }
+};
+
+// ---------- base primes ----------
+
+//primes up to n with a plain sieve, the sieving primes of every segment
+inline std::vector<unsigned long long> base_primes_up_to(unsigned long long n) {
+    std::vector<bool> is_prime(n + 1, true);
+    std::vector<unsigned long long> primes;
+    for (unsigned long long p = 2; p <= n; ++p) {
+        if (is_prime[p]) {
+            primes.push_back(p);
+            for (unsigned long long i = p * p; i <= n; i += p) {
+                is_prime[i] = false;
+            }
+        }
+    }
+    return primes;
+}
+
+//floor(sqrt(n)), sqrt() of a double can be one off for big n
+inline unsigned long long isqrt(unsigned long long n) {
+    unsigned long long r = static_cast<unsigned long long>(std::sqrt(static_cast<double>(n)));
+    while (r * r > n) {
+        --r;
+    }
+    while ((r + 1) * (r + 1) <= n) {
+        ++r;
+    }
+    return r;
+}
+
+// ---------- backends ----------
+
+//Make is called once per thread and returns that thread's worker, worker(s) sieves segment s and returns its count.
+//PthreadBackend throws std::system_error if a thread cannot be created, after joining the ones that were
+struct OpenMPBackend {
+    static constexpr const char *name = "openmp";
+
+    template <class Aggregation, class Make>
+    static unsigned long long run(long long num_segments, int num_threads, Make make) {
+        unsigned long long total = 0;
+        if constexpr (Aggregation::kind == AggregationKind::Reduction) {
+            #pragma omp parallel num_threads(num_threads) reduction(+:total)
+            {
+                topo_bind_omp_thread(omp_get_thread_num());
+                auto worker = make();
+                #pragma omp for
+                for (long long s = 0; s < num_segments; ++s) {
+                    total += worker(s);
+                }
+            }
+        } else if constexpr (Aggregation::kind == AggregationKind::Critical) {
+            #pragma omp parallel num_threads(num_threads)
+            {
+                topo_bind_omp_thread(omp_get_thread_num());
+                auto worker = make();
+                unsigned long long local_count = 0;
+                #pragma omp for nowait
+                for (long long s = 0; s < num_segments; ++s) {
+                    local_count += worker(s);
+                }
+                #pragma omp critical
+                {
+                    total += local_count;
+                }
+            }
+        } else {
+            #pragma omp parallel num_threads(num_threads)
+            {
+                topo_bind_omp_thread(omp_get_thread_num());
+                auto worker = make();
+                #pragma omp for
+                for (long long s = 0; s < num_segments; ++s) {
+                    unsigned long long count = worker(s);
+                    #pragma omp atomic
+                    total += count;
+                }
+            }
+        }
+        return total;
+    }
+};
+
+struct PthreadBackend {
+    static constexpr const char *name = "pthread";
+
+    template <class Aggregation, class Make>
+    struct Task {
+        int id;
+        int num_threads;
+        long long num_segments;
+        const Make *make;
+        unsigned long long local_count;
+        unsigned long long *total;
+        pthread_mutex_t *lock;
+
+        static void *entry(void *arg) {
+            Task *task = static_cast<Task *>(arg);
+            //contiguous run of segments per thread, like the blocks of assignment 2
+            long long per_thread = task->num_segments / task->num_threads;
+            long long first = task->id * per_thread;
+            long long last = task->id == task->num_threads - 1 ? task->num_segments : first + per_thread;
+
+            auto worker = (*task->make)();
+            for (long long s = first; s < last; ++s) {
+                unsigned long long count = worker(s);
+                if constexpr (Aggregation::kind == AggregationKind::Atomic) {
+                    __atomic_fetch_add(task->total, count, __ATOMIC_RELAXED);
+                } else {
+                    task->local_count += count;
+                }
+            }
+            if constexpr (Aggregation::kind == AggregationKind::Critical) {
+                pthread_mutex_lock(task->lock);
+                *task->total += task->local_count;
+                pthread_mutex_unlock(task->lock);
+            }
+            return nullptr;
+        }
+    };
+
+    template <class Aggregation, class Make>
+    static unsigned long long run(long long num_segments, int num_threads, Make make) {
+        using T = Task<Aggregation, Make>;
+        unsigned long long total = 0;
+        pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+        std::vector<pthread_t> threads(num_threads);
+        std::vector<T> tasks(num_threads);
+
+        for (int i = 0; i < num_threads; ++i) {
+            tasks[i] = T{i, num_threads, num_segments, &make, 0, &total, &lock};
+            pthread_attr_t attr;
+            int created = pthread_create(&threads[i], topo_attr_for_thread(&attr, i), T::entry, &tasks[i]);
+            pthread_attr_destroy(&attr);
+            if (created != 0) {
+                for (int j = 0; j < i; ++j) { //the running threads still use tasks, make and total
+                    pthread_join(threads[j], nullptr);
+                }
+                throw std::system_error(created, std::generic_category(), "pthread_create");
+            }
+        }
+        for (int i = 0; i < num_threads; ++i) {
+            pthread_join(threads[i], nullptr);
+            if constexpr (Aggregation::kind == AggregationKind::Reduction) {
+                total += tasks[i].local_count;
+            }
+        }
+        return total;
+    }
+};
+
+// ---------- the engine ----------
+
+struct Phases {
+    PerfPhase *base_primes;
+    PerfPhase *segment_sieve;
+    PerfPhase *counting;
+};
+
+template <class Storage, unsigned M, class Aggregation, class Backend>
+class SegmentedSieve {
+public:
+    using WheelType = Wheel<M>;
+
+    //numbers per segment: about sqrt(limit) like the original block_size, rounded to whole 64 bit words of slots
+    static unsigned long long segment_span(unsigned long long limit_sqrt) {
+        unsigned long long unit = 64ULL * M;
+        unsigned long long span = std::max(limit_sqrt, unit);
+        return (span + unit - 1) / unit * unit;
+    }
+
+    //number of primes <= limit. phases may be null when the caller does not collect counters
+    static unsigned long long count(unsigned long long limit, int num_threads, const Phases *phases = nullptr) {
+        if (limit < 2) {
+            return 0;
+        }
+        Plan plan(limit, phases);
+        auto make = [&]() { return Worker(plan, phases); };
+        return plan.head_primes.size() + Backend::template run<Aggregation>(plan.num_segments, num_threads, make);
+    }
+
+    //one pass that feeds every prime <= limit to all the given statistics, e.g.
+    //    auto [pi, twins] = Sieve::collect<PrimeCount, TwinPrimes>(limit, threads);
+    //the summaries are kept per segment index and merged in order after the threads are done
+    template <class... Statistics>
+    static std::tuple<Statistics...> collect(unsigned long long limit, int num_threads, const Phases *phases = nullptr) {
+        using Summary = std::tuple<typename Statistics::Segment...>;
+        std::tuple<Statistics...> totals;
+        if (limit < 2) {
+            return totals;
+        }
+        Plan plan(limit, phases);
+
+        Summary head;
+        for (unsigned long long p : plan.head_primes) {
+            add_prime(head, p);
+        }
+        std::vector<Summary> summaries(plan.num_segments);
+        auto make = [&]() {
+            return [worker = Worker(plan, phases), &summaries](long long s) mutable {
+                Summary &summary = summaries[s];
+                worker.visit(s, [&](unsigned long long p) { add_prime(summary, p); });
+                return 0ULL;
+            };
+        };
+        Backend::template run<Aggregation>(plan.num_segments, num_threads, make);
+
+        merge_summary(totals, head, std::index_sequence_for<Statistics...>{});
+        for (const Summary &summary : summaries) {
+            merge_summary(totals, summary, std::index_sequence_for<Statistics...>{});
+        }
+        return totals;
+    }
+
+    //traffic model for roofline_report: stored slots are initialised and counted once per segment, and the
+    //marking stores only reach memory when a segment does not fit in the cache
+    static double traffic(unsigned long long limit, double *ops) {
+        unsigned long long limit_sqrt = isqrt(limit);
+        std::vector<unsigned long long> base_primes = base_primes_up_to(limit_sqrt);
+        double fraction = static_cast<double>(WheelType::count) / M;
+        double bytes_per_number = Storage::bytes_per_slot * fraction;
+        double segment_bytes = segment_span(limit_sqrt) * bytes_per_number;
+        double numbers = limit > limit_sqrt ? static_cast<double>(limit - limit_sqrt) : 0.0;
+        double bytes = 2.0 * numbers * bytes_per_number;
+        double marks = 0.0;
+        for (unsigned long long p : base_primes) {
+            if (WheelType::divides_modulus(p)) {
+                continue;
+            }
+            unsigned long long start = std::max(p * p, limit_sqrt + 1);
+            double m = start <= limit ? static_cast<double>(limit / p - (start - 1) / p) * fraction : 0.0;
+            marks += m;
+            if (segment_bytes > ROOFLINE_CACHED_SEGMENT_BYTES) {
+                bytes += roofline_strided_bytes(m, p * bytes_per_number);
+            }
+        }
+        if (ops) {
+            *ops = marks + numbers * fraction;
+        }
+        return bytes;
+    }
+
+private:
+    template <class Summary>
+    static void add_prime(Summary &summary, unsigned long long p) {
+        std::apply([p](auto &...seg) { (seg.add(p), ...); }, summary);
+    }
+
+    template <class Totals, class Summary, size_t... I>
+    static void merge_summary(Totals &totals, const Summary &summary, std::index_sequence<I...>) {
+        (std::get<I>(totals).merge(std::get<I>(summary)), ...);
+    }
+
+    static bool is_small_prime(unsigned long long p) {
+        if (p < 2) {
+            return false;
+        }
+        for (unsigned long long d = 2; d * d <= p; ++d) {
+            if (p % d == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //everything the threads share: sieving primes and the segment layout
+    struct Plan {
+        unsigned long long limit, lo_valid, first, span;
+        long long num_segments;
+        std::vector<unsigned long long> sieving_primes;
+        std::vector<unsigned long long> head_primes; //primes <= limit that are not in a segment, increasing
+
+        Plan(unsigned long long limit_, const Phases *phases) : limit(limit_) {
+            PerfThreadCounters base_pc;
+            if (phases) {
+                perf_phase_begin(&base_pc);
+            }
+            unsigned long long limit_sqrt = isqrt(limit);
+            head_primes = base_primes_up_to(limit_sqrt);
+            for (unsigned long long p : head_primes) {
+                if (!WheelType::divides_modulus(p)) {
+                    sieving_primes.push_back(p);
+                }
+            }
+            //primes of the wheel are never stored, the ones above sqrt(limit) are added here. they are the smallest
+            //primes, so they still come before everything in the segments
+            for (unsigned long long p = limit_sqrt + 1; p <= limit && p <= M; ++p) {
+                if (WheelType::divides_modulus(p) && is_small_prime(p)) {
+                    head_primes.push_back(p);
+                }
+            }
+            if (phases) {
+                perf_phase_end(&base_pc, phases->base_primes);
+            }
+
+            //segments start at a multiple of M so the slot of a number only depends on its offset
+            lo_valid = limit_sqrt + 1;
+            first = lo_valid / M * M;
+            span = segment_span(limit_sqrt);
+            num_segments = limit >= first ? static_cast<long long>((limit - first) / span + 1) : 0;
+        }
+    };
+
+    //per thread state: the segment buffer is allocated once and reused for every segment of the thread
+    class Worker {
+    public:
+        Worker(const Plan &plan, const Phases *phases) : plan_(plan), phases_(phases) {
+            perf_thread_open(&pc_);
+        }
+        Worker(Worker &&other) noexcept
+            : plan_(other.plan_), phases_(other.phases_), pc_(other.pc_), storage_(std::move(other.storage_)) {
+            for (int e = 0; e < PERF_NUM_EVENTS; ++e) {
+                other.pc_.fds[e] = -1;
+            }
+        }
+        Worker(const Worker &) = delete;
+        ~Worker() {
+            perf_thread_close(&pc_);
+        }
+
+        //primes in segment s
+        unsigned long long operator()(long long s) {
+            sieve(s);
+            perf_thread_begin(&pc_);
+            unsigned long long found = storage_.count(first_slot_, last_slot_);
+            if (phases_) {
+                perf_thread_end(&pc_, phases_->counting);
+            }
+            return found;
+        }
+
+        //calls f(p) for every prime p in segment s in increasing order
+        template <class F>
+        void visit(long long s, F f) {
+            sieve(s);
+            perf_thread_begin(&pc_);
+            unsigned long long base = base_;
+            storage_.for_each_set(first_slot_, last_slot_, [base, &f](unsigned long long slot) {
+                f(base + slot / WheelType::count * M + WheelType::residues[slot % WheelType::count]);
+            });
+            if (phases_) {
+                perf_thread_end(&pc_, phases_->counting);
+            }
+        }
+
+    private:
+        //strikes out the multiples of the sieving primes in segment s, the primes are then the set slots in
+        //[first_slot_, last_slot_)
+        void sieve(long long s) {
+            unsigned long long base = plan_.first + static_cast<unsigned long long>(s) * plan_.span;
+            unsigned long long hi = std::min(base + plan_.span - 1, plan_.limit);
+            unsigned long long slots = WheelType::ceil_slot(hi + 1 - base);
+
+            perf_thread_begin(&pc_);
+            storage_.reset(slots);
+            for (unsigned long long p : plan_.sieving_primes) {
+                unsigned long long start = std::max(p * p, base);
+                if (start > hi) {
+                    break; //primes are increasing, so p * p only grows
+                }
+                unsigned gi;
+                unsigned long long k = WheelType::next_coprime((start + p - 1) / p, gi);
+                for (unsigned long long m = p * k; m <= hi;) {
+                    storage_.clear(WheelType::ceil_slot(m - base));
+                    m += p * WheelType::gaps[gi];
+                    gi = gi + 1 == WheelType::count ? 0 : gi + 1;
+                }
+            }
+            if (phases_) {
+                perf_thread_end(&pc_, phases_->segment_sieve);
+            }
+
+            unsigned long long lo = std::max(base, plan_.lo_valid);
+            base_ = base;
+            first_slot_ = lo <= hi ? WheelType::ceil_slot(lo - base) : slots;
+            last_slot_ = slots;
+        }
+
+        const Plan &plan_;
+        const Phases *phases_;
+        PerfThreadCounters pc_;
+        Storage storage_;
+        unsigned long long base_ = 0, first_slot_ = 0, last_slot_ = 0;
+    };
+};
+
+} // namespace sieve
+
+#endif
@@ -0,0 +1,456 @@
+/*
+CPU topology, thread placement and NUMA local allocation for the pthread and OpenMP drivers.
+
+None of the programs used to pin their threads, so on SMT machines two sieve or SpMV threads could end up on the
+two hyperthreads of one core, or move between cores, and the timings changed from run to run. This module reads
+/sys/devices/system/cpu and /sys/devices/system/node once (logical cpus, their core and package, SMT siblings, the
+last level cache they share and their NUMA node) and maps thread i of a team to a cpu with one of the policies
+    compact   fill both hyperthreads of a core, then the next core of the same node
+    scatter   spread the threads over the nodes and cores first, the second hyperthread of a core is used last
+    physical  one thread per physical core, the SMT siblings are never used (wraps around if there are more threads)
+    none      no pinning, the scheduler decides (default, same behaviour as before)
+The policy is taken from the environment variable PDC_PLACEMENT, e.g. PDC_PLACEMENT=scatter ./a.out ...
+
+pthread_create sites use topo_attr_for_thread() for the attribute of thread i, OpenMP teams call
+topo_bind_omp_thread() at the start of the parallel region. Buffers owned by one thread (block_sieve, CSR row
+slices) come from topo_alloc_local(): the memory is mmap'ed, preferred on the node of the calling thread with
+mbind when there is more than one node, and the first write by the pinned thread faults the pages in there.
+
+The files using this header must define _GNU_SOURCE before their first include for the affinity calls.
+*/
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#define TOPO_MAX_CPUS 1024
+#define TOPO_MAX_NODES 64
+
+typedef enum {
+    TOPO_NONE,
+    TOPO_COMPACT,
+    TOPO_SCATTER,
+    TOPO_PHYSICAL
+} TopoPolicy;
+
+typedef struct {
+    int cpu;
+    int core; //index of the physical core, unique over all packages
+    int package;
+    int node;
+    int smt_index; //0 for the first hyperthread of the core, 1 for the second...
+    int llc; //lowest cpu sharing the last level cache with this one
+} TopoCpu;
+
+typedef struct {
+    int num_cpus;
+    int num_cores;
+    int num_nodes;
+    int num_llcs;
+    long llc_bytes; //size of the highest level cache, 0 if unknown
+    TopoCpu cpus[TOPO_MAX_CPUS];
+    int compact_order[TOPO_MAX_CPUS];
+    int scatter_order[TOPO_MAX_CPUS];
+    int physical_order[TOPO_MAX_CPUS];
+    int num_physical;
+} Topology;
+
+static inline int topo_read_int(const char *path, int fallback) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return fallback;
+    }
+    int value;
+    if (fscanf(f, "%d", &value) != 1) {
+        value = fallback;
+    }
+    fclose(f);
+    return value;
+}
+
+//parses a sysfs cpu list like "0-3,8-11" into a mask, returns the number of cpus in it
+static inline int topo_read_cpulist(const char *path, unsigned char *mask) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    char line[4096];
+    int count = 0;
+    if (fgets(line, sizeof(line), f)) {
+        char *p = line;
+        while (*p && *p != '\n') {
+            char *end;
+            long first = strtol(p, &end, 10);
+            if (end == p) {
+                break;
+            }
+            long last = first;
+            if (*end == '-') {
+                p = end + 1;
+                last = strtol(p, &end, 10);
+            }
+            for (long cpu = first; cpu <= last && cpu < TOPO_MAX_CPUS; cpu++) {
+                if (cpu >= 0 && !mask[cpu]) {
+                    mask[cpu] = 1;
+                    count++;
+                }
+            }
+            p = end;
+            if (*p == ',') {
+                p++;
+            }
+        }
+    }
+    fclose(f);
+    return count;
+}
+
+static inline int topo_first_in_list(const char *path, int fallback) {
+    unsigned char mask[TOPO_MAX_CPUS];
+    memset(mask, 0, sizeof(mask));
+    if (topo_read_cpulist(path, mask) == 0) {
+        return fallback;
+    }
+    for (int cpu = 0; cpu < TOPO_MAX_CPUS; cpu++) {
+        if (mask[cpu]) {
+            return cpu;
+        }
+    }
+    return fallback;
+}
+
+static inline long topo_read_size(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    long size = 0;
+    char unit = 0;
+    if (fscanf(f, "%ld%c", &size, &unit) >= 1) {
+        if (unit == 'K') size *= 1024;
+        else if (unit == 'M') size *= 1024 * 1024;
+    }
+    fclose(f);
+    return size;
+}
+
+static inline Topology *topo_global() {
+    static Topology topo;
+    return &topo;
+}
+
+//sort key of the compact order
+static inline int topo_compare_compact(const void *a, const void *b) {
+    const TopoCpu *x = &topo_global()->cpus[*(const int *)a];
+    const TopoCpu *y = &topo_global()->cpus[*(const int *)b];
+    if (x->node != y->node) return x->node - y->node;
+    if (x->package != y->package) return x->package - y->package;
+    if (x->core != y->core) return x->core - y->core;
+    return x->smt_index - y->smt_index;
+}
+
+//reads the topology from sysfs. a missing file is treated as a machine without SMT, with one node and one LLC, so
+//the placement still works (it just has less to choose from)
+static inline void topo_init() {
+    Topology *topo = topo_global();
+
+    unsigned char online[TOPO_MAX_CPUS];
+    memset(online, 0, sizeof(online));
+    if (topo_read_cpulist("/sys/devices/system/cpu/online", online) == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long cpu = 0; cpu < cpus && cpu < TOPO_MAX_CPUS; cpu++) {
+            online[cpu] = 1;
+        }
+    }
+
+    int node_of[TOPO_MAX_CPUS];
+    for (int cpu = 0; cpu < TOPO_MAX_CPUS; cpu++) {
+        node_of[cpu] = 0;
+    }
+    int num_nodes = 0; //highest node id + 1, node ids can have holes
+    for (int node = 0; node < TOPO_MAX_NODES; node++) {
+        char path[128];
+        unsigned char mask[TOPO_MAX_CPUS];
+        memset(mask, 0, sizeof(mask));
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (topo_read_cpulist(path, mask) == 0) {
+            continue;
+        }
+        for (int cpu = 0; cpu < TOPO_MAX_CPUS; cpu++) {
+            if (mask[cpu]) {
+                node_of[cpu] = node;
+            }
+        }
+        num_nodes = node + 1;
+    }
+    topo->num_nodes = num_nodes > 0 ? num_nodes : 1;
+
+    int core_key[TOPO_MAX_CPUS]; //first SMT sibling of every core, used to number the cores
+    int num_cores = 0;
+    int num_llcs = 0;
+    int llc_level = 0; //level of the cache llc_bytes was taken from
+    for (int cpu = 0; cpu < TOPO_MAX_CPUS; cpu++) {
+        if (!online[cpu]) {
+            continue;
+        }
+        char path[160];
+        TopoCpu *c = &topo->cpus[topo->num_cpus];
+        c->cpu = cpu;
+        c->node = node_of[cpu];
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        c->package = topo_read_int(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        int first_sibling = topo_first_in_list(path, cpu);
+
+        unsigned char siblings[TOPO_MAX_CPUS];
+        memset(siblings, 0, sizeof(siblings));
+        topo_read_cpulist(path, siblings);
+        c->smt_index = 0;
+        for (int other = 0; other < cpu; other++) {
+            if (siblings[other]) {
+                c->smt_index++;
+            }
+        }
+
+        c->core = -1;
+        for (int k = 0; k < num_cores; k++) {
+            if (core_key[k] == first_sibling) {
+                c->core = k;
+            }
+        }
+        if (c->core < 0) {
+            core_key[num_cores] = first_sibling;
+            c->core = num_cores++;
+        }
+
+        //the last level cache is the cache index with the highest level
+        c->llc = cpu;
+        int best_level = 0;
+        for (int index = 0; index < 16; index++) {
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+            int level = topo_read_int(path, -1);
+            if (level < 0) {
+                break;
+            }
+            if (level >= best_level) {
+                best_level = level;
+                snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+                c->llc = topo_first_in_list(path, cpu);
+                //the size of the highest level wins, a bigger cache of a lower level (an L2 larger than the L3
+                //slice) does not
+                snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/size", cpu, index);
+                long size = topo_read_size(path);
+                if (size > 0 && (level > llc_level || (level == llc_level && size > topo->llc_bytes))) {
+                    llc_level = level;
+                    topo->llc_bytes = size;
+                }
+            }
+        }
+        if (c->llc == cpu) {
+            num_llcs++;
+        }
+        topo->num_cpus++;
+    }
+    topo->num_cores = num_cores;
+    topo->num_llcs = num_llcs > 0 ? num_llcs : 1;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    //some VMs and containers have no cache entries in sysfs, glibc can still report the sizes from cpuid
+    if (topo->llc_bytes <= 0) {
+        long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        if (size <= 0) {
+            size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        }
+        topo->llc_bytes = size > 0 ? size : 0;
+    }
+#endif
+
+    for (int i = 0; i < topo->num_cpus; i++) {
+        topo->compact_order[i] = i;
+    }
+    qsort(topo->compact_order, topo->num_cpus, sizeof(int), topo_compare_compact);
+
+    //scatter: take the cpus of every smt level round robin over the nodes, so consecutive threads land on
+    //different nodes (and different cores), and only then move on to the second hyperthreads
+    int filled = 0;
+    int max_smt = 0;
+    for (int i = 0; i < topo->num_cpus; i++) {
+        if (topo->cpus[i].smt_index > max_smt) {
+            max_smt = topo->cpus[i].smt_index;
+        }
+    }
+    for (int smt = 0; smt <= max_smt; smt++) {
+        int taken[TOPO_MAX_CPUS];
+        memset(taken, 0, sizeof(taken));
+        int remaining = 0;
+        for (int i = 0; i < topo->num_cpus; i++) {
+            remaining += topo->cpus[i].smt_index == smt;
+        }
+        while (remaining > 0) {
+            for (int node = 0; node < topo->num_nodes; node++) {
+                for (int k = 0; k < topo->num_cpus; k++) {
+                    int i = topo->compact_order[k];
+                    if (!taken[i] && topo->cpus[i].smt_index == smt && topo->cpus[i].node == node) {
+                        taken[i] = 1;
+                        topo->scatter_order[filled++] = i;
+                        remaining--;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    topo->num_physical = 0;
+    for (int k = 0; k < topo->num_cpus; k++) {
+        int i = topo->compact_order[k];
+        if (topo->cpus[i].smt_index == 0) {
+            topo->physical_order[topo->num_physical++] = i;
+        }
+    }
+}
+
+//the topology, read on the first call. the first callers are often worker threads that all start together (e.g.
+//topo_alloc_local in every sieve thread), so the read runs under pthread_once
+static inline const Topology *topo_get() {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, topo_init);
+    return topo_global();
+}
+
+static inline const char *topo_policy_name(TopoPolicy policy) {
+    switch (policy) {
+        case TOPO_COMPACT: return "compact";
+        case TOPO_SCATTER: return "scatter";
+        case TOPO_PHYSICAL: return "physical";
+        default: return "none";
+    }
+}
+
+static inline int *topo_policy_value() {
+    static int policy = TOPO_NONE;
+    return &policy;
+}
+
+static inline void topo_policy_init() {
+    const char *env = getenv("PDC_PLACEMENT");
+    int *policy = topo_policy_value();
+    if (env != NULL) {
+        if (strcmp(env, "compact") == 0) *policy = TOPO_COMPACT;
+        else if (strcmp(env, "scatter") == 0) *policy = TOPO_SCATTER;
+        else if (strcmp(env, "physical") == 0) *policy = TOPO_PHYSICAL;
+        else if (strcmp(env, "none") != 0 && env[0] != '\0') {
+            fprintf(stderr, "Unknown PDC_PLACEMENT %s, expected compact, scatter, physical or none.\n", env);
+        }
+    }
+}
+
+//placement policy of the run, from PDC_PLACEMENT. read once under pthread_once like the topology
+static inline TopoPolicy topo_policy() {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, topo_policy_init);
+    return (TopoPolicy)*topo_policy_value();
+}
+
+//logical cpu for thread thread_index of a team under the policy, -1 for TOPO_NONE
+static inline int topo_cpu_for_thread(TopoPolicy policy, int thread_index) {
+    if (policy == TOPO_NONE) {
+        return -1;
+    }
+    const Topology *topo = topo_get();
+    if (topo->num_cpus == 0) {
+        return -1;
+    }
+    int i;
+    if (policy == TOPO_COMPACT) {
+        i = topo->compact_order[thread_index % topo->num_cpus];
+    } else if (policy == TOPO_SCATTER) {
+        i = topo->scatter_order[thread_index % topo->num_cpus];
+    } else {
+        i = topo->physical_order[thread_index % topo->num_physical];
+    }
+    return topo->cpus[i].cpu;
+}
+
+//initialises attr for thread thread_index of a pthread team, pinned according to PDC_PLACEMENT.
+//the caller destroys it with pthread_attr_destroy after pthread_create
+static inline pthread_attr_t *topo_attr_for_thread(pthread_attr_t *attr, int thread_index) {
+    pthread_attr_init(attr);
+    int cpu = topo_cpu_for_thread(topo_policy(), thread_index);
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+    }
+    return attr;
+}
+
+//pins the calling thread as thread thread_index of its team, for OpenMP parallel regions
+static inline void topo_bind_omp_thread(int thread_index) {
+    int cpu = topo_cpu_for_thread(topo_policy(), thread_index);
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+}
+
+//NUMA node the calling thread currently runs on
+static inline int topo_current_node() {
+    int cpu = sched_getcpu();
+    const Topology *topo = topo_get();
+    for (int i = 0; i < topo->num_cpus; i++) {
+        if (topo->cpus[i].cpu == cpu) {
+            return topo->cpus[i].node;
+        }
+    }
+    return 0;
+}
+
+//size bytes on the node of the calling thread, NULL on failure. free with topo_free_local
+static inline void *topo_alloc_local(size_t size) {
+    if (size == 0) {
+        size = 1;
+    }
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+    const Topology *topo = topo_get();
+    if (topo->num_nodes > 1) {
+        unsigned long nodemask = 1UL << topo_current_node();
+        //only a preference, the allocation still succeeds if the node is full
+        syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, &nodemask, (unsigned long)TOPO_MAX_NODES, 0);
+    }
+    return ptr;
+}
+
+static inline void topo_free_local(void *ptr, size_t size) {
+    if (ptr != NULL) {
+        munmap(ptr, size == 0 ? 1 : size);
+    }
+}
+
+//one line summary of the machine and the placement, printed by the drivers when a policy is active
+static inline void topo_print_placement() {
+    TopoPolicy policy = topo_policy();
+    if (policy == TOPO_NONE) {
+        return;
+    }
+    const Topology *topo = topo_get();
+    printf("Thread placement: %s (%d cpus, %d cores, %d LLC domain(s) of %ld KB, %d NUMA node(s))\n",
+           topo_policy_name(policy), topo->num_cpus, topo->num_cores, topo->num_llcs, topo->llc_bytes / 1024,
+           topo->num_nodes);
+}
+
+#endif